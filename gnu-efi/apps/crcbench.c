@@ -0,0 +1,172 @@
+/*
+ * Checks CalculateCrc against known CRC32 vectors, a plain byte-wise
+ * CRC and the firmware's CalculateCrc32, then measures its throughput
+ * with and without the PCLMULQDQ path.
+ *
+ * FS0:\> crcbench.efi
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#define BUF_SIZE	(1024 * 1024)
+#define BYTES_PER_SIZE	(32 * 1024 * 1024)
+
+extern UINT32 CRCTable[256];
+#if defined(__x86_64__)
+extern BOOLEAN LibHasPclmul;
+#endif
+
+static const struct {
+	const CHAR8 *data;
+	UINT32 crc;
+} vectors[] = {
+	{ (const CHAR8 *)"", 0x00000000 },
+	{ (const CHAR8 *)"a", 0xe8b7be43 },
+	{ (const CHAR8 *)"abc", 0x352441c2 },
+	{ (const CHAR8 *)"123456789", 0xcbf43926 },
+	{ (const CHAR8 *)"The quick brown fox jumps over the lazy dog", 0x414fa339 },
+	{ (const CHAR8 *)"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+			 "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789", 0xbc43350f },
+};
+
+static const UINTN sizes[] = { 16, 64, 256, 1024, 4096, 65536, BUF_SIZE };
+
+static inline UINT64
+rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+/* The one byte per iteration loop CalculateCrc used to be. */
+static UINT32
+byte_crc(const UINT8 *p, UINTN size)
+{
+	UINT32 crc = 0xffffffff;
+
+	while (size--)
+		crc = (crc >> 8) ^ CRCTable[(UINT8)crc ^ *p++];
+
+	return crc ^ 0xffffffff;
+}
+
+static UINT64
+time_crc(const UINT8 *p, UINTN size)
+{
+	UINTN n = BYTES_PER_SIZE / size;
+	UINT64 start = rdtsc();
+	volatile UINT32 sink;
+
+	for (UINTN i = 0; i < n; i++)
+		sink = CalculateCrc((UINT8 *)p, size);
+	(void)sink;
+
+	return (rdtsc() - start) / n;
+}
+
+static UINT64
+time_byte_crc(const UINT8 *p, UINTN size)
+{
+	UINTN n = BYTES_PER_SIZE / size;
+	UINT64 start = rdtsc();
+	volatile UINT32 sink;
+
+	for (UINTN i = 0; i < n; i++)
+		sink = byte_crc(p, size);
+	(void)sink;
+
+	return (rdtsc() - start) / n;
+}
+
+/* Every length up to 300 at every alignment, plus some large ones. */
+static BOOLEAN
+check_lengths(UINT8 *buf)
+{
+	UINT32 fw;
+
+	for (UINTN off = 0; off < 16; off++) {
+		for (UINTN size = 0; size < 300; size++) {
+			if (CalculateCrc(buf + off, size) != byte_crc(buf + off, size))
+				return FALSE;
+		}
+	}
+
+	for (UINTN size = 1000; size < BUF_SIZE; size = size * 3 + 7) {
+		if (CalculateCrc(buf + 3, size) != byte_crc(buf + 3, size))
+			return FALSE;
+		if (!EFI_ERROR(uefi_call_wrapper(BS->CalculateCrc32, 3, buf + 3, size, &fw))
+		    && fw != CalculateCrc(buf + 3, size))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+EFI_STATUS
+efi_main (EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
+{
+	BOOLEAN ok = TRUE;
+	UINT8 *buf;
+
+	InitializeLib(image, systab);
+
+	for (UINTN i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		UINT32 crc = CalculateCrc((UINT8 *)vectors[i].data, strlena(vectors[i].data));
+		if (crc != vectors[i].crc) {
+			Print(L"vector %lu: got %08x, expected %08x\n", i, crc, vectors[i].crc);
+			ok = FALSE;
+		}
+	}
+
+	buf = AllocatePool(BUF_SIZE + 16);
+	if (!buf) {
+		Print(L"Out of memory\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	for (UINTN i = 0; i < BUF_SIZE + 16; i++)
+		buf[i] = (UINT8)(i * 2654435761u >> 13);
+
+	ok = ok && check_lengths(buf);
+#if defined(__x86_64__)
+	if (LibHasPclmul) {
+		LibHasPclmul = FALSE;
+		ok = ok && check_lengths(buf);
+		LibHasPclmul = TRUE;
+	}
+#endif
+	Print(L"CRC32 vectors and lengths: %a\n", ok ? "ok" : "FAILED");
+
+#if defined(__x86_64__)
+	Print(L"%8a %12a %12a %12a\n", "size", "byte loop", "slice-by-8", LibHasPclmul ? "pclmul" : "-");
+#else
+	Print(L"%8a %12a %12a\n", "size", "byte loop", "slice-by-8");
+#endif
+
+	for (UINTN i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		UINTN size = sizes[i];
+		UINT64 b = time_byte_crc(buf, size);
+#if defined(__x86_64__)
+		BOOLEAN pclmul = LibHasPclmul;
+		UINT64 f = 0;
+
+		LibHasPclmul = FALSE;
+		UINT64 s = time_crc(buf, size);
+		LibHasPclmul = pclmul;
+		if (pclmul)
+			f = time_crc(buf, size);
+
+		Print(L"%8lu %12lu %12lu %12lu\n", size, b, s, f);
+#else
+		Print(L"%8lu %12lu %12lu\n", size, b, time_crc(buf, size));
+#endif
+	}
+
+	Print(L"(TSC ticks per call)\n");
+
+	FreePool(buf);
+	return ok ? EFI_SUCCESS : EFI_ABORTED;
+}
@@ -0,0 +1,81 @@
+/*
+ * Dumps the handle database, every handle with the protocols on it,
+ * then times GuidToString over all of those protocol GUIDs.
+ *
+ * FS0:\> hdbdump.efi
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#define ROUNDS		100
+#define MAX_GUIDS	4096
+
+static EFI_GUID all_guids[MAX_GUIDS];
+
+static inline UINT64
+rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+EFI_STATUS
+efi_main (EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
+{
+	EFI_STATUS status;
+	EFI_HANDLE *handles;
+	UINTN n_handles, n_guids = 0, known = 0;
+	CHAR16 name[64];
+	UINT64 start, ticks;
+
+	InitializeLib(image, systab);
+
+	status = LibLocateHandle(AllHandles, NULL, NULL, &n_handles, &handles);
+	if (EFI_ERROR(status)) {
+		Print(L"LocateHandle: %r\n", status);
+		return status;
+	}
+
+	for (UINTN i = 0; i < n_handles; i++) {
+		EFI_GUID **guids;
+		UINTN count;
+
+		if (EFI_ERROR(uefi_call_wrapper(BS->ProtocolsPerHandle, 3, handles[i], &guids, &count)))
+			continue;
+
+		Print(L"%3lu %lx:", i, (UINT64)handles[i]);
+		for (UINTN j = 0; j < count; j++) {
+			GuidToString(name, guids[j]);
+			/* Unknown GUIDs come back in their 36 character form. */
+			if (StrLen(name) != 36)
+				known++;
+			Print(L" %s", name);
+			if (n_guids + j < MAX_GUIDS)
+				all_guids[n_guids + j] = *guids[j];
+		}
+		Print(L"\n");
+
+		n_guids += count;
+		FreePool(guids);
+	}
+
+	/* Lookups only, without the console in the way. */
+	UINTN timed = n_guids < MAX_GUIDS ? n_guids : MAX_GUIDS;
+
+	start = rdtsc();
+	for (UINTN round = 0; round < ROUNDS; round++) {
+		for (UINTN i = 0; i < timed; i++)
+			GuidToString(name, &all_guids[i]);
+	}
+	ticks = rdtsc() - start;
+
+	Print(L"%lu handles, %lu protocols, %lu with a known name\n", n_handles, n_guids, known);
+	if (timed)
+		Print(L"%lu TSC ticks per GuidToString\n", ticks / (timed * ROUNDS));
+
+	FreePool(handles);
+	return EFI_SUCCESS;
+}
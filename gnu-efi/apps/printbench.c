@@ -0,0 +1,140 @@
+/*
+ * Builds long strings with CatPrint and PoolPrint and reports the cost
+ * per append as the string grows.  With geometric growth the cost stays
+ * flat; the old fixed +200 character growth is timed for comparison.
+ * First checks that CatPrint copes with an argument aliasing its string.
+ *
+ * FS0:\> printbench.efi
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#define OLD_GROWTH	200
+
+static const UINTN counts[] = { 1000, 4000, 16000, 64000 };
+
+static inline UINT64
+rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+/* What lib/print.c used to do: grow by OLD_GROWTH characters per overflow. */
+static void
+old_cat(POOL_PRINT *str, UINTN value)
+{
+	CHAR16 buf[32];
+	UINTN len = SPrint(buf, sizeof(buf), L"%08x ", value);
+
+	if (str->len + len + 1 > str->maxlen) {
+		UINTN newlen = str->len + len + 1 + OLD_GROWTH;
+
+		str->str = ReallocatePool(str->str, str->len * sizeof(CHAR16),
+					  newlen * sizeof(CHAR16));
+		str->maxlen = newlen;
+	}
+
+	CopyMem(str->str + str->len, buf, (len + 1) * sizeof(CHAR16));
+	str->len += len;
+}
+
+/*
+ * Doubles a string by appending it to itself, both with and without room
+ * reserved for formatting in place, until the pool has had to grow.
+ */
+static BOOLEAN
+alias_check(UINTN reserve)
+{
+	POOL_PRINT s;
+	CHAR16 *copy;
+	UINTN len;
+	BOOLEAN ok = TRUE;
+
+	ZeroMem(&s, sizeof(s));
+	if (reserve)
+		CatPrintReserve(&s, reserve);
+	CatPrint(&s, L"ab");
+
+	for (UINTN i = 0; ok && i < 12; i++) {
+		len = s.len;
+		copy = StrDuplicate(s.str);
+		CatPrint(&s, L"<%s>", s.str);
+
+		ok = copy && s.str && s.len == 2 * len + 2 &&
+		     !StrnCmp(s.str, copy, len) && s.str[len] == '<' &&
+		     !StrnCmp(s.str + len + 1, copy, len) && !StrCmp(s.str + 2 * len + 1, L">");
+		if (copy)
+			FreePool(copy);
+	}
+
+	if (s.str)
+		FreePool(s.str);
+	return ok;
+}
+
+EFI_STATUS
+efi_main (EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
+{
+	InitializeLib(image, systab);
+
+	if (!alias_check(0) || !alias_check(1 << 16)) {
+		Print(L"CatPrint of its own string is wrong\n");
+		return EFI_ABORTED;
+	}
+
+	Print(L"%8a %12a %12a %12a %12a\n", "appends", "old", "CatPrint", "reserved", "PoolPrint");
+
+	for (UINTN i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		UINTN n = counts[i];
+		POOL_PRINT old, cat, res;
+		CHAR16 *pool, *fmt;
+		UINT64 start, to, tc, tr, tp;
+
+		ZeroMem(&old, sizeof(old));
+		ZeroMem(&cat, sizeof(cat));
+		ZeroMem(&res, sizeof(res));
+
+		start = rdtsc();
+		for (UINTN j = 0; j < n; j++)
+			old_cat(&old, j);
+		to = rdtsc() - start;
+
+		start = rdtsc();
+		for (UINTN j = 0; j < n; j++)
+			CatPrint(&cat, L"%08x ", j);
+		tc = rdtsc() - start;
+
+		start = rdtsc();
+		CatPrintReserve(&res, n * 9 + 1);
+		for (UINTN j = 0; j < n; j++)
+			CatPrint(&res, L"%08x ", j);
+		tr = rdtsc() - start;
+
+		/* One PoolPrint of the whole string through a %s item. */
+		fmt = L"%s";
+		start = rdtsc();
+		pool = PoolPrint(fmt, cat.str);
+		tp = rdtsc() - start;
+
+		if (!old.str || !cat.str || !res.str || !pool ||
+		    old.len != n * 9 || cat.len != n * 9 || res.len != n * 9 ||
+		    StrCmp(old.str, cat.str) || StrCmp(cat.str, res.str) || StrCmp(cat.str, pool)) {
+			Print(L"Mismatch building %lu appends\n", n);
+			return EFI_ABORTED;
+		}
+
+		Print(L"%8lu %12lu %12lu %12lu %12lu\n", n, to / n, tc / n, tr / n, tp / n);
+
+		FreePool(old.str);
+		FreePool(cat.str);
+		FreePool(res.str);
+		FreePool(pool);
+	}
+
+	Print(L"(TSC ticks per append, PoolPrint per 9 characters)\n");
+	return EFI_SUCCESS;
+}
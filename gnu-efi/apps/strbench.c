@@ -0,0 +1,167 @@
+/*
+ * Checks StrLen, StrCmp, StrCpy and StriCmp against plain CHAR16 loops
+ * at every alignment, then times them on path-sized strings.
+ *
+ * FS0:\> strbench.efi
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#define MAX_LEN		300
+#define ROUNDS		100000
+
+static const UINTN lengths[] = { 8, 32, 64, 128, 256 };
+
+static inline UINT64
+rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+/* What lib/runtime/rtstr.c used to do. */
+static UINTN __attribute__((noinline))
+char_len(const CHAR16 *s)
+{
+	UINTN len = 0;
+
+	while (s[len])
+		len++;
+	return len;
+}
+
+static INTN __attribute__((noinline))
+char_cmp(const CHAR16 *s1, const CHAR16 *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	return *s1 - *s2;
+}
+
+static CHAR16
+upper(CHAR16 c)
+{
+	return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+static INTN
+sign(INTN v)
+{
+	return v < 0 ? -1 : v > 0;
+}
+
+static void
+fill(CHAR16 *s, UINTN len, UINTN seed)
+{
+	for (UINTN i = 0; i < len; i++)
+		s[i] = L"abcdefghijklmnopqrstuvwxyz\\./ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"[(i * 7 + seed) % 65];
+	s[len] = 0;
+}
+
+static BOOLEAN
+check(CHAR16 *a, CHAR16 *b)
+{
+	/* Without a collation protocol StriCmp is case sensitive. */
+	BOOLEAN folds = StriCmp(L"a", L"A") == 0;
+
+	for (UINTN off1 = 0; off1 < 4; off1++) {
+		for (UINTN off2 = 0; off2 < 4; off2++) {
+			for (UINTN len = 0; len < 40; len++) {
+				CHAR16 *s1 = a + off1, *s2 = b + off2;
+
+				fill(s1, len, len);
+				if (StrLen(s1) != len)
+					return FALSE;
+
+				StrCpy(s2, s1);
+				if (char_cmp(s1, s2) || StrCmp(s1, s2))
+					return FALSE;
+
+				for (UINTN i = 0; i < len; i++) {
+					CHAR16 c = s2[i];
+
+					s2[i] = c + 1;
+					if (sign(StrCmp(s1, s2)) != sign(char_cmp(s1, s2)))
+						return FALSE;
+
+					s2[i] = upper(c) == c ? c | 0x20 : upper(c);
+					if (folds && c >= 'a' && c <= 'z' && StriCmp(s1, s2))
+						return FALSE;
+					s2[i] = c;
+				}
+
+				s2[len / 2] = 0;
+				if (sign(StrCmp(s1, s2)) != sign(char_cmp(s1, s2)))
+					return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+EFI_STATUS
+efi_main (EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
+{
+	CHAR16 *a, *b;
+
+	InitializeLib(image, systab);
+
+	a = AllocatePool((MAX_LEN + 8) * sizeof(CHAR16));
+	b = AllocatePool((MAX_LEN + 8) * sizeof(CHAR16));
+	if (!a || !b) {
+		Print(L"Out of memory\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	Print(L"Self check: %a\n", check(a, b) ? "ok" : "FAILED");
+	Print(L"%8a %12a %12a %12a %12a %12a\n", "length", "char len", "StrLen", "char cmp", "StrCmp", "StriCmp");
+
+	for (UINTN i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		UINTN len = lengths[i];
+		UINT64 start, tl, tsl, tc, tsc, tsi;
+		volatile UINTN sink = 0;
+
+		fill(a, len, 0);
+		fill(b, len, 0);
+
+		start = rdtsc();
+		for (UINTN j = 0; j < ROUNDS; j++)
+			sink += char_len(a);
+		tl = rdtsc() - start;
+
+		start = rdtsc();
+		for (UINTN j = 0; j < ROUNDS; j++)
+			sink += StrLen(a);
+		tsl = rdtsc() - start;
+
+		start = rdtsc();
+		for (UINTN j = 0; j < ROUNDS; j++)
+			sink += char_cmp(a, b);
+		tc = rdtsc() - start;
+
+		start = rdtsc();
+		for (UINTN j = 0; j < ROUNDS; j++)
+			sink += StrCmp(a, b);
+		tsc = rdtsc() - start;
+
+		start = rdtsc();
+		for (UINTN j = 0; j < ROUNDS; j++)
+			sink += StriCmp(a, b);
+		tsi = rdtsc() - start;
+
+		Print(L"%8lu %12lu %12lu %12lu %12lu %12lu\n", len,
+		      tl / ROUNDS, tsl / ROUNDS, tc / ROUNDS, tsc / ROUNDS, tsi / ROUNDS);
+	}
+
+	Print(L"(TSC ticks per call)\n");
+
+	FreePool(a);
+	FreePool(b);
+	return EFI_SUCCESS;
+}
@@ -2,15 +2,71 @@
 #define CONFIG_H
 
 // 1 for true, 0 for false.
+// These are only defaults, CONFIG_PATH and then the loader's
+// command line (quiet, verbose, nowallpaper, timeout=N) override them.
 #define USE_WALLPAPER 1
 #define VERBOSE 1
 
+// Skip the wallpaper, menu and all framebuffer text.
+#define QUIET 0
+
+// Seconds before DEFAULT_ENTRY boots, 0 boots right away, -1 waits forever.
+#define BOOT_TIMEOUT 5
+#define DEFAULT_ENTRY 0
+
 // Outline for boot menu window.
 #define DRAW_OUTLINE 1
 
+// Set up a startup page the kernel can start the application processors on.
+#define START_APS 1
+
+// Stack size for each application processor, in 4 KiB pages.
+#define AP_STACK_PAGES 4
+
+// Kernel stack size in 4 KiB pages, a guard page is placed below it.
+#define KERNEL_STACK_PAGES 16
+
+// Per-CPU area (GS base) size in 4 KiB pages, 0 to disable.
+#define PERCPU_PAGES 1
+
+// Call SetVirtualAddressMap after ExitBootServices, runtime regions end up at
+// PhysicalStart + RUNTIME_VIRT_OFFSET. Leave 0 (identity) unless the kernel maps
+// physical memory at a fixed higher-half base.
+#define SET_VIRTUAL_MAP 1
+#define RUNTIME_VIRT_OFFSET 0
+
+// Boots kept in the FacelessBootHistory NV variable, 0 to disable.
+// Each boot rewrites the variable, so this costs one flash write per boot.
+#define BOOT_HISTORY_LEN 16
+
+// Mirror loader and kernel text to a 16550 UART (COM1 = 0x3F8).
+#define SERIAL_CONSOLE 1
+#define SERIAL_PORT 0x3F8
+#define SERIAL_BAUD 115200
+
+// Boot log ring handed to the kernel, in 4 KiB pages, 0 to disable.
+#define BOOT_LOG_PAGES 4
+
+// Arena for the loader's small allocations (font, file info, final memory map), in 4 KiB pages.
+// Unused pages are given back before ExitBootServices.
+#define LOADER_ARENA_PAGES 64
+
+// Console Print buffer in characters, lines are coalesced into one OutputString call.
+// 0 writes every Print straight to the console.
+#define PRINT_BUFFER 4096
+
+// Dev mode, 0 boots the kernel on the ESP, 1 pulls it over serial (kernel/devsend.py),
+// 2 reads it from a second FAT drive (make rundev). Falls back to the ESP if that fails.
+#define DEV_MODE 0
+
+// Seconds to wait for the host in serial dev mode.
+#define DEV_SERIAL_TIMEOUT 10
+
 // Path in kernel/bin/
+#define CONFIG_PATH L"faceless.cfg"
 #define WALLPAPER_PATH L"fs.bmp"
 #define PSF1_FONT_PATH L"zap-light16.psf"
+#define KERNEL_PATH L"kernel.elf"
 
 
 #endif
@@ -19,9 +19,130 @@
 #define PSF1_HEADER_SIZE 4
 #define TITLE "FacelessBoot v0.0.1"
 
+// CpuInfo flags.
+#define CPU_BSP         (1 << 0)
+#define CPU_PARKED      (1 << 1)        // AP is spinning on its mailbox.
+
+#define MAX_BOOT_STAGES 32
+
+// Boot history kept in an NV variable, stage_us[i] lines up with boot_trace.stages[i].
+#define BOOT_HISTORY_VERSION 1
+#define BOOT_HISTORY_STAGES 12
+#define BOOT_HISTORY_VAR L"FacelessBootHistory"
+#define FACELESS_VENDOR_GUID \
+    { 0x5f1a3c2e, 0x8d47, 0x4b6a, {0x9e, 0x21, 0x6c, 0x0b, 0xd4, 0x73, 0xa5, 0x18} }
+
+// Boot configuration limits.
+#define MAX_BOOT_ENTRIES 8
+#define MAX_MODULES 4
+#define CONFIG_PATH_LEN 64
+#define CONFIG_STR_LEN 256
+
+// 16550 UART registers, offsets from SERIAL_PORT.
+#define UART_DATA       0
+#define UART_IER        1
+#define UART_FCR        2
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_LSR_THRE   0x20            // Transmit FIFO empty.
+#define UART_LSR_TEMT   0x40            // FIFO and shift register empty.
+#define UART_FIFO_SIZE  16
+#define SERIAL_RING_SIZE 4096
+
+// Where dev mode pulls the kernel from, see DEV_MODE in config.h.
+#define DEV_OFF         0
+#define DEV_SERIAL      1
+#define DEV_DRIVE       2
+#define DEV_MAGIC       0x56454446      // "FDEV" little endian.
+#define DEV_MAX_SIZE    (64 * 1024 * 1024)
+#define DEV_RETRIES     3
+
+#define UART_LSR_DR     0x01            // Received byte waiting.
+
+// OS-defined memory type, marks the boot log in the memory map so the kernel keeps it.
+#define BOOT_LOG_MEMORY_TYPE 0x80000001
+
+// Same for the loader arena (font, final memory map).
+#define LOADER_ARENA_MEMORY_TYPE 0x80000002
+
+#define MSR_GS_BASE     0xC0000101
+#define MSR_EFER        0xC0000080
+#define EFER_LMA        (1 << 10)
+#define CR4_PAE         (1 << 5)
+// CR4 bits the APs copy from the BSP: PGE, OSFXSR, OSXMMEXCPT, LA57.
+#define AP_CR4_MASK     ((1 << 7) | (1 << 9) | (1 << 10) | (1 << 12))
+
+// The AP startup page must sit below 1 MiB for the SIPI vector.
+#define AP_STARTUP_MAX_ADDRESS  0x9FFFF
+#define AP_STARTUP_MEMORY_TYPE  0x80000003
+#define AP_TRAMPOLINE_DATA      8
+#define STACK_GUARD_BYTE 0xCC
+
 // If we are in the boot menu.
 uint8_t boot_mode = 1;
 
+// Small loader allocations come from here, one AllocatePages for all of them.
+MEMORY_ARENA loader_arena;
+
+struct BootEntry {
+    char name[CONFIG_PATH_LEN];
+    CHAR16 kernel_path[CONFIG_PATH_LEN];
+    char cmdline[CONFIG_STR_LEN];
+    CHAR16 modules[MAX_MODULES][CONFIG_PATH_LEN];
+    uint32_t n_modules;
+    uint32_t video_width;           // 0 keeps the firmware's mode.
+    uint32_t video_height;
+};
+
+// Runtime copies of the config.h defaults, then CONFIG_PATH.
+struct BootOptions {
+    uint8_t use_wallpaper;
+    uint8_t verbose;
+    uint8_t quiet;
+    uint8_t draw_outline;
+    uint8_t serial;
+    uint8_t dev;                    // DEV_OFF, DEV_SERIAL or DEV_DRIVE.
+    int32_t timeout;                // Seconds, 0 boots right away, -1 waits forever.
+    uint8_t default_entry;
+    CHAR16 wallpaper_path[CONFIG_PATH_LEN];
+    CHAR16 font_path[CONFIG_PATH_LEN];
+    uint32_t n_entries;
+    struct BootEntry entries[MAX_BOOT_ENTRIES];
+} boot_options = {
+    .use_wallpaper = USE_WALLPAPER,
+    .verbose = VERBOSE,
+    .quiet = QUIET,
+    .draw_outline = DRAW_OUTLINE,
+    .serial = SERIAL_CONSOLE,
+    .dev = DEV_MODE,
+    .timeout = BOOT_TIMEOUT,
+    .default_entry = DEFAULT_ENTRY,
+    .wallpaper_path = WALLPAPER_PATH,
+    .font_path = PSF1_FONT_PATH,
+};
+
+// Menu items after the boot entries.
+static const struct {
+    const char* name;
+    EFI_RESET_TYPE type;
+} reset_items[] = {
+    {"Reboot", EfiResetWarm},
+    {"Reboot (cold)", EfiResetCold},
+    {"Shut down", EfiResetShutdown},
+};
+
+#define N_RESET_ITEMS (sizeof(reset_items) / sizeof(reset_items[0]))
+
+// Module loaded for the kernel.
+struct BootModule {
+    void* base;
+    uint64_t size;
+    char path[CONFIG_PATH_LEN];
+};
+
+struct BootModule boot_modules[MAX_MODULES];
+
 struct __attribute__((packed)) BMP {
     struct __attribute__((packed)) Header {
         uint16_t signature;                     // 'BM'.
@@ -54,6 +175,63 @@ struct __attribute__((packed)) BMP {
     char pixel_data[];
 };
 
+/*
+ *  One per CPU, cache line sized so that parked APs
+ *  do not share lines while they spin on their mailbox.
+ *
+ *  APs are not running at handoff. Once the kernel starts
+ *  them on the ap_startup page they set CPU_PARKED and wait
+ *  for an entry point in goto_address (or *release_all), which
+ *  is then called (sysv_abi) with a pointer to their CpuInfo
+ *  on the stack the loader allocated for them.
+ *
+ *  The trampoline below depends on this layout.
+ */
+struct CpuInfo {
+    uint32_t apic_id;
+    uint32_t flags;
+    volatile uint64_t goto_address;
+    uint64_t extra_argument;            // Free for the kernel to use.
+    uint64_t stack_top;
+    uint64_t percpu;                    // GS base, 0 if per-CPU areas are disabled.
+} __attribute__((aligned(64)));
+
+// TSC taken at a named point during boot.
+struct BootStage {
+    char name[24];
+    uint64_t tsc;
+};
+
+struct BootTrace {
+    uint32_t count;
+    struct BootStage stages[MAX_BOOT_STAGES];
+} boot_trace;
+
+// Loader text, each line starts with a [seconds.micros] stamp.
+// Bytes text[i % size] for i in [head - size, head) when head > size, else [0, head).
+struct BootLog {
+    uint64_t size;
+    uint64_t head;                          // Bytes ever written.
+    char text[];
+};
+
+// One boot, fixed size so the variable never needs parsing.
+struct BootRecord {
+    uint32_t seq;                           // Increases every boot, 0 marks an empty slot.
+    uint16_t n_stages;
+    uint16_t entry;                         // Boot entry that was picked.
+    uint32_t total_us;
+    uint32_t stage_us[BOOT_HISTORY_STAGES]; // Time since the previous stage.
+};
+
+struct BootHistory {
+    uint32_t version;
+    uint32_t next;                          // Slot the next boot is written to.
+    struct BootRecord records[BOOT_HISTORY_LEN];
+} boot_history;
+
+// Passed to the kernel by value. Fields are only ever added at the end, so a
+// kernel built against an older copy of this struct still reads the fields it knows.
 struct RuntimeDataAndServices {
     struct Framebuffer {
         void* base_addr;
@@ -104,9 +282,86 @@ struct RuntimeDataAndServices {
     void(*term_write)(const char* str, uint32_t color);
     uint64_t(*get_mmap_entries)(void);
     EFI_MEMORY_DESCRIPTOR*(*index_mmap)(uint64_t index);
+
+    // Firmware configuration tables, NULL if not present.
+    struct ConfigTables {
+        void* rsdp;                 // ACPI 1.0 RSDP.
+        void* xsdp;                 // ACPI 2.0+ RSDP (has XSDT address).
+        void* smbios;               // SMBIOS 2.x entry point.
+        void* smbios3;              // SMBIOS 3.x (64-bit) entry point.
+        EFI_SYSTEM_TABLE* system_table;
+    } config_tables;
+
+    struct Smp {
+        uint64_t cpu_count;
+        uint32_t bsp_apic_id;
+        struct CpuInfo* cpus;
+        volatile uint64_t* release_all;     // Entry point written here releases every parked AP.
+        uint64_t percpu_size;
+    } smp;
+
+    struct KernelStack {
+        uint64_t guard;             // Guard page, just below base.
+        uint64_t base;
+        uint64_t top;               // Initial rsp.
+    } kernel_stack;
+
+    struct Timebase {
+        uint64_t tsc_frequency;     // Hz, 0 if it could not be calibrated.
+        uint64_t boot_tsc;          // TSC at efi_main entry.
+        uint8_t invariant_tsc;      // TSC runs at a constant rate in all P/C states.
+    } timebase;
+
+    struct BootTrace* boot_trace;
+
+    struct Modules {
+        uint64_t count;
+        struct BootModule* list;
+    } modules;
+
+    const char* cmdline;            // Command line of the booted entry, never NULL.
+
+    // EfiResetCold (0), EfiResetWarm (1) or EfiResetShutdown (2) through EFI runtime services.
+    void(*reset_system)(uint32_t type);
+
+    // Runtime services after SetVirtualAddressMap, NULL if the firmware refused the new map.
+    // Every EFI_MEMORY_RUNTIME region is moved to PhysicalStart + virt_offset, the kernel
+    // must map them there before calling through this table.
+    struct EfiRuntime {
+        EFI_RUNTIME_SERVICES* rt;
+        uint64_t virt_offset;
+        // sysv -> ms_abi thunk, call runtime services as efi_call(rt->GetTime, (uint64_t)&time, 0, 0, 0, 0).
+        uint64_t(*efi_call)(void* func, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5);
+    } efi_runtime;
+
+    struct BootHistory* boot_history;       // Last BOOT_HISTORY_LEN boots including this one, NULL if not saved.
+
+    // Serial console, write and flush are NULL if there is no UART.
+    struct Serial {
+        uint16_t port;
+        void(*write)(const char* str);      // Buffered, sends what fits in the FIFO and returns.
+        void(*flush)(void);                 // Waits until everything is on the wire.
+    } serial;
+
+    struct BootLog* boot_log;               // NULL if BOOT_LOG_PAGES is 0 or the allocation failed.
+
+    // Real mode startup page for the APs, page is 0 if there is none
+    // (a single CPU, or the loader's page tables are above 4 GiB).
+    // The kernel sends INIT-SIPI-SIPI with vector page >> 12 to start them.
+    struct ApStartup {
+        uint64_t page;                      // Below 1 MiB.
+        uint32_t* cr3;                      // Page table root the APs load, must be below 4 GiB.
+    } ap_startup;
 } runtime_services;
 
 
+// Set once the kernel is loaded.
+static void(*kernel_entry)(struct RuntimeDataAndServices);
+
+// From lib/x86_64/efi_stub.S.
+UINT64 efi_call5(void* func, UINT64 a1, UINT64 a2, UINT64 a3, UINT64 a4, UINT64 a5);
+
+
 uint64_t get_mmap_entries(void) {
     return runtime_services.mmap.mapSize / runtime_services.mmap.mapDescSize;
 }
@@ -142,6 +397,845 @@ void init_gop(void) {
 }
 
 
+// Switches GOP to width x height if the firmware has such a mode.
+void set_video_mode(uint32_t width, uint32_t height) {
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL* gop;
+
+    if (EFI_ERROR(uefi_call_wrapper(BS->LocateProtocol, 3, &gop_guid, NULL, (void**)&gop))) {
+        return;
+    }
+
+    if (gop->Mode->Info->HorizontalResolution == width && gop->Mode->Info->VerticalResolution == height) {
+        return;
+    }
+
+    for (UINT32 mode = 0; mode < gop->Mode->MaxMode; ++mode) {
+        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info;
+        UINTN info_size;
+
+        if (EFI_ERROR(uefi_call_wrapper(gop->QueryMode, 4, gop, mode, &info_size, &info))) {
+            continue;
+        }
+
+        if (info->HorizontalResolution == width && info->VerticalResolution == height) {
+            if (!EFI_ERROR(uefi_call_wrapper(gop->SetMode, 2, gop, mode))) {
+                init_gop();
+            }
+
+            return;
+        }
+    }
+}
+
+
+/*
+ *  Resets or powers off through EFI ResetSystem.
+ *
+ *  Once SetVirtualAddressMap has gone through the firmware only
+ *  works through the converted table, so that one is used then,
+ *  RT before.
+ *
+ *  Falls back to pulsing the 8042 reset line if the
+ *  firmware returns, and halts if that does nothing either.
+ *
+ */
+
+void reset_system(uint32_t type) {
+    EFI_RUNTIME_SERVICES* rt = runtime_services.efi_runtime.rt ? runtime_services.efi_runtime.rt : RT;
+    uefi_call_wrapper(rt->ResetSystem, 4, (EFI_RESET_TYPE)type, EFI_SUCCESS, 0, NULL);
+
+    if (type != EfiResetShutdown) {
+        __asm__ __volatile__("out %%al, %%dx" : :"a" (0xFE), "d" (0x64));
+    }
+
+    while (1) {
+        __asm__ __volatile__("cli; hlt");
+    }
+}
+
+
+// Walks the configuration table once and saves the tables the kernel cares about.
+void find_config_tables(EFI_SYSTEM_TABLE* sysTable) {
+    runtime_services.config_tables.system_table = sysTable;
+
+    for (UINTN i = 0; i < sysTable->NumberOfTableEntries; ++i) {
+        EFI_CONFIGURATION_TABLE* table = &sysTable->ConfigurationTable[i];
+
+        if (CompareGuid(&table->VendorGuid, &Acpi20TableGuid) == 0) {
+            runtime_services.config_tables.xsdp = table->VendorTable;
+        } else if (CompareGuid(&table->VendorGuid, &AcpiTableGuid) == 0) {
+            runtime_services.config_tables.rsdp = table->VendorTable;
+        } else if (CompareGuid(&table->VendorGuid, &SMBIOS3TableGuid) == 0) {
+            runtime_services.config_tables.smbios3 = table->VendorTable;
+        } else if (CompareGuid(&table->VendorGuid, &SMBIOSTableGuid) == 0) {
+            runtime_services.config_tables.smbios = table->VendorTable;
+        }
+    }
+}
+
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ __volatile__("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ __volatile__("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (leaf), "c" (subleaf));
+}
+
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a" (value), "Nd" (port));
+}
+
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ __volatile__("inb %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+
+// Bytes waiting for the UART, head == tail when empty.
+static struct {
+    char buf[SERIAL_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} serial_ring;
+
+
+// Moves bytes from the ring into the UART while its FIFO has room, never waits.
+void serial_drain(void) {
+    uint16_t port = runtime_services.serial.port;
+
+    while (serial_ring.head != serial_ring.tail && (inb(port + UART_LSR) & UART_LSR_THRE)) {
+        // THRE means the whole FIFO is free, fill it in one go.
+        for (uint32_t i = 0; i < UART_FIFO_SIZE && serial_ring.head != serial_ring.tail; ++i) {
+            outb(port + UART_DATA, serial_ring.buf[serial_ring.tail]);
+            serial_ring.tail = (serial_ring.tail + 1) % SERIAL_RING_SIZE;
+        }
+    }
+}
+
+
+static void serial_put(char c) {
+    uint32_t next = (serial_ring.head + 1) % SERIAL_RING_SIZE;
+
+    // Ring is full, wait for the UART to take some.
+    while (next == serial_ring.tail) {
+        serial_drain();
+        __asm__ __volatile__("pause");
+    }
+
+    serial_ring.buf[serial_ring.head] = c;
+    serial_ring.head = next;
+}
+
+
+void serial_write(const char* str) {
+    if (!runtime_services.serial.port) return;
+
+    for (; *str; ++str) {
+        if (*str == '\n') serial_put('\r');
+        serial_put(*str);
+    }
+
+    serial_drain();
+}
+
+
+void serial_flush(void) {
+    if (!runtime_services.serial.port) return;
+
+    while (serial_ring.head != serial_ring.tail) {
+        serial_drain();
+    }
+
+    while (!(inb(runtime_services.serial.port + UART_LSR) & UART_LSR_TEMT));
+}
+
+
+// Waits up to timeout_us for a received byte, returns 0 on timeout.
+uint8_t serial_read(uint8_t* c, uint64_t timeout_us) {
+    uint16_t port = runtime_services.serial.port;
+
+    for (uint64_t waited = 0; ; waited += 10) {
+        if (inb(port + UART_LSR) & UART_LSR_DR) {
+            *c = inb(port + UART_DATA);
+            return 1;
+        }
+
+        if (waited >= timeout_us) return 0;
+        uefi_call_wrapper(BS->Stall, 1, 10);
+    }
+}
+
+
+// Sets up SERIAL_PORT as 8N1 with FIFOs, leaves the serial console off if no UART answers.
+void serial_init(void) {
+    uint16_t port = SERIAL_PORT;
+    uint16_t divisor = 115200 / SERIAL_BAUD;
+
+    if (!boot_options.serial) return;
+
+    outb(port + UART_IER, 0x00);                // No interrupts, we poll.
+    outb(port + UART_LCR, 0x80);                // DLAB on to set the divisor.
+    outb(port + UART_DATA, divisor & 0xFF);
+    outb(port + UART_IER, divisor >> 8);
+    outb(port + UART_LCR, 0x03);                // 8N1, DLAB off.
+    outb(port + UART_FCR, 0xC7);                // Enable and clear FIFOs.
+
+    // Loopback test, nothing is there if the byte does not come back.
+    outb(port + UART_MCR, 0x1E);
+    outb(port + UART_DATA, 0xAE);
+    if (inb(port + UART_DATA) != 0xAE) return;
+
+    outb(port + UART_MCR, 0x0F);                // Normal operation.
+
+    runtime_services.serial.port = port;
+    runtime_services.serial.write = serial_write;
+    runtime_services.serial.flush = serial_flush;
+}
+
+
+static struct BootLog* boot_log;
+static uint8_t boot_log_line_start = 1;
+static EFI_TEXT_OUTPUT_STRING firmware_output_string;
+
+
+static inline void boot_log_put(char c) {
+    boot_log->text[boot_log->head++ % boot_log->size] = c;
+}
+
+
+// Writes value in decimal, right aligned to width with pad.
+static void boot_log_number(uint64_t value, uint32_t width, char pad) {
+    char digits[20];
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    for (; width > n; --width) boot_log_put(pad);
+    while (n) boot_log_put(digits[--n]);
+}
+
+
+void boot_log_write(const char* str) {
+    if (!boot_log) return;
+
+    uint64_t tsc_per_us = runtime_services.timebase.tsc_frequency / 1000000;
+
+    for (; *str; ++str) {
+        if (boot_log_line_start) {
+            uint64_t us = tsc_per_us ? (rdtsc() - runtime_services.timebase.boot_tsc) / tsc_per_us : 0;
+            boot_log_put('[');
+            boot_log_number(us / 1000000, 5, ' ');
+            boot_log_put('.');
+            boot_log_number(us % 1000000, 6, '0');
+            boot_log_put(']');
+            boot_log_put(' ');
+            boot_log_line_start = 0;
+        }
+
+        boot_log_put(*str);
+        boot_log_line_start = *str == '\n';
+    }
+}
+
+
+// Sits in front of ConOut->OutputString so Print() ends up in the log too.
+static EFI_STATUS EFIAPI boot_log_output_string(SIMPLE_TEXT_OUTPUT_INTERFACE* this, CHAR16* str) {
+    char buf[128];
+    UINTN n = 0;
+
+    for (CHAR16* c = str; *c; ++c) {
+        if (*c == L'\r') continue;
+
+        buf[n++] = *c < 0x80 ? (char)*c : '?';
+        if (n == sizeof(buf) - 1) {
+            buf[n] = '\0';
+            boot_log_write(buf);
+            n = 0;
+        }
+    }
+
+    buf[n] = '\0';
+    boot_log_write(buf);
+
+    return uefi_call_wrapper(firmware_output_string, 2, this, str);
+}
+
+
+// Allocates the log in its own region and starts capturing loader text.
+void boot_log_init(EFI_SYSTEM_TABLE* sysTable) {
+    EFI_PHYSICAL_ADDRESS base;
+
+    if (BOOT_LOG_PAGES == 0) return;
+
+    // Firmware that rejects OS memory types still gets a log, the kernel just can't spot it in the map.
+    if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, BOOT_LOG_MEMORY_TYPE, BOOT_LOG_PAGES, &base))
+        && EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, BOOT_LOG_PAGES, &base))) {
+        return;
+    }
+
+    boot_log = (struct BootLog*)base;
+    boot_log->size = BOOT_LOG_PAGES * EFI_PAGE_SIZE - sizeof(struct BootLog);
+    boot_log->head = 0;
+    runtime_services.boot_log = boot_log;
+
+    firmware_output_string = sysTable->ConOut->OutputString;
+    sysTable->ConOut->OutputString = boot_log_output_string;
+}
+
+
+// Gives ConOut back before the firmware tears it down.
+void boot_log_detach(EFI_SYSTEM_TABLE* sysTable) {
+    if (firmware_output_string) {
+        sysTable->ConOut->OutputString = firmware_output_string;
+    }
+}
+
+
+// Records the TSC at a named checkpoint, stages past MAX_BOOT_STAGES are dropped.
+void boot_stage(const char* name) {
+    if (boot_trace.count >= MAX_BOOT_STAGES) return;
+
+    struct BootStage* stage = &boot_trace.stages[boot_trace.count++];
+    stage->tsc = rdtsc();
+
+    size_t i = 0;
+    for (; name[i] && i < sizeof(stage->name) - 1; ++i) {
+        stage->name[i] = name[i];
+    }
+
+    stage->name[i] = '\0';
+}
+
+
+// Prints how long each stage took since the one before it.
+// One boot trace line: the GOP console normally, only serial and the boot log in quiet mode.
+static void boot_trace_write(const CHAR16* fmt, ...) {
+    CHAR16 line[80];
+    char ascii[80];
+    va_list args;
+
+    va_start(args, fmt);
+    UINTN len = VSPrint(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (!boot_options.quiet) {
+        Print(L"%s", line);
+        return;
+    }
+
+    for (UINTN i = 0; i <= len; ++i) {
+        ascii[i] = line[i] < 0x80 ? (char)line[i] : '?';
+    }
+
+    boot_log_write(ascii);
+    serial_write(ascii);
+}
+
+
+void print_boot_trace(void) {
+    uint64_t last = runtime_services.timebase.boot_tsc;
+    uint64_t tsc_per_us = runtime_services.timebase.tsc_frequency / 1000000;
+
+    if (tsc_per_us == 0) return;
+
+    for (uint32_t i = 0; i < boot_trace.count; ++i) {
+        boot_trace_write(L"%-24a %8lu us\n", boot_trace.stages[i].name, (boot_trace.stages[i].tsc - last) / tsc_per_us);
+        last = boot_trace.stages[i].tsc;
+    }
+
+    boot_trace_write(L"%-24a %8lu us\n", "total", (last - runtime_services.timebase.boot_tsc) / tsc_per_us);
+
+    UINTN outputCalls, savedCalls;
+    LibPrintStats(&outputCalls, &savedCalls);
+    boot_trace_write(L"%-24a %8lu calls, %lu saved\n", "OutputString", outputCalls, savedCalls);
+}
+
+
+/*
+ *  Appends this boot's stage times to the ring in
+ *  BOOT_HISTORY_VAR and hands the ring to the kernel.
+ *
+ *  The variable is rewritten as a whole, a missing or
+ *  mismatched one (other version/size) starts a new ring.
+ *
+ */
+
+void save_boot_history(uint16_t entry) {
+#if BOOT_HISTORY_LEN
+    EFI_GUID guid = FACELESS_VENDOR_GUID;
+    uint64_t tsc_per_us = runtime_services.timebase.tsc_frequency / 1000000;
+    UINTN size;
+
+    if (tsc_per_us == 0) return;
+
+    struct BootHistory* saved = LibGetVariableAndSize(BOOT_HISTORY_VAR, &guid, &size);
+    if (saved && size == sizeof(boot_history) && saved->version == BOOT_HISTORY_VERSION && saved->next < BOOT_HISTORY_LEN) {
+        CopyMem(&boot_history, saved, sizeof(boot_history));
+    } else {
+        ZeroMem(&boot_history, sizeof(boot_history));
+        boot_history.version = BOOT_HISTORY_VERSION;
+    }
+
+    if (saved) {
+        FreePool(saved);
+    }
+
+    struct BootRecord* last = &boot_history.records[(boot_history.next + BOOT_HISTORY_LEN - 1) % BOOT_HISTORY_LEN];
+    struct BootRecord* record = &boot_history.records[boot_history.next];
+    uint64_t tsc = runtime_services.timebase.boot_tsc;
+
+    ZeroMem(record, sizeof(*record));
+    record->seq = last->seq + 1;
+    record->entry = entry;
+    record->n_stages = boot_trace.count < BOOT_HISTORY_STAGES ? boot_trace.count : BOOT_HISTORY_STAGES;
+
+    for (uint16_t i = 0; i < record->n_stages; ++i) {
+        record->stage_us[i] = (boot_trace.stages[i].tsc - tsc) / tsc_per_us;
+        tsc = boot_trace.stages[i].tsc;
+    }
+
+    record->total_us = (tsc - runtime_services.timebase.boot_tsc) / tsc_per_us;
+    boot_history.next = (boot_history.next + 1) % BOOT_HISTORY_LEN;
+
+    if (!EFI_ERROR(LibSetNVVariable(BOOT_HISTORY_VAR, &guid, sizeof(boot_history), &boot_history))) {
+        runtime_services.boot_history = &boot_history;
+    }
+#endif
+}
+
+
+/*
+ *  Finds the TSC frequency.
+ *
+ *  CPUID leaf 0x15 gives it exactly when the crystal
+ *  frequency is reported, otherwise it is measured
+ *  against a 10ms BS->Stall.
+ *
+ */
+
+void calibrate_tsc(EFI_SYSTEM_TABLE* sysTable) {
+    uint32_t a, b, c, d;
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &d);
+        runtime_services.timebase.invariant_tsc = (d >> 8) & 1;
+    }
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a >= 0x15) {
+        cpuid(0x15, 0, &a, &b, &c, &d);     // TSC = crystal (ecx) * ebx / eax.
+        if (a && b && c) {
+            runtime_services.timebase.tsc_frequency = (uint64_t)c * b / a;
+            return;
+        }
+    }
+
+    const uint64_t STALL_US = 10000;
+    uint64_t start = rdtsc();
+    uefi_call_wrapper(sysTable->BootServices->Stall, 1, STALL_US);
+    runtime_services.timebase.tsc_frequency = (rdtsc() - start) * (1000000 / STALL_US);
+}
+
+
+// Returns the (x2)APIC ID of the CPU we are running on.
+static uint32_t get_apic_id(void) {
+    uint32_t a, b, c, d;
+    cpuid(0, 0, &a, &b, &c, &d);
+
+    if (a >= 0xB) {
+        cpuid(0xB, 0, &a, &b, &c, &d);
+        if (b != 0) return d;       // x2APIC ID.
+    }
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    return b >> 24;
+}
+
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+/*
+ *  Data at AP_TRAMPOLINE_DATA in the AP startup page,
+ *  the offsets are hardcoded in ap_trampoline.
+ *
+ */
+
+struct __attribute__((packed)) ApTrampolineData {
+    uint64_t cpus;                  // +8
+    uint64_t cpu_count;             // +16
+    uint64_t release_all;           // +24
+    uint64_t efer;                  // +32
+    uint32_t cr3;                   // +40
+    uint32_t cr4;                   // +44
+    uint32_t long_entry;            // +48, far pointer to the 64-bit code.
+    uint16_t code_sel;              // +52
+    uint16_t gdt_limit;             // +54, GDT pointer.
+    uint32_t gdt_base;              // +56
+    uint32_t reserved;
+    uint64_t gdt[3];                // +64
+};
+
+_Static_assert(sizeof(struct ApTrampolineData) == 80, "ap_trampoline hardcodes this layout");
+
+/*
+ *  Copied to the AP startup page, an AP the kernel sends a SIPI to
+ *  starts at its first byte in real mode. It goes straight to long mode
+ *  on the loader's GDT and the CR3 in the data block, finds its CpuInfo
+ *  by APIC ID, switches to its stack, sets CPU_PARKED and waits for an
+ *  entry point in goto_address or *release_all. Everything it needs
+ *  lives in the page and the CpuInfo block, not in the loader image.
+ */
+__asm__(
+    ".text\n"
+    ".globl ap_trampoline\n"
+    ".globl ap_trampoline_long\n"
+    ".globl ap_trampoline_end\n"
+    ".code16\n"
+    "ap_trampoline:\n"
+    "    jmp 1f\n"
+    "    .balign 8\n"
+    "ap_trampoline_data:\n"
+    "    .skip 80\n"
+    "1:  cli\n"
+    "    cld\n"
+    "    movw %cs, %ax\n"
+    "    movw %ax, %ds\n"
+    "    lgdtl 54\n"
+    "    movl 44, %eax\n"
+    "    movl %eax, %cr4\n"
+    "    movl 40, %eax\n"
+    "    movl %eax, %cr3\n"
+    "    movl $0xC0000080, %ecx\n"
+    "    movl 32, %eax\n"
+    "    movl 36, %edx\n"
+    "    orl $0x100, %eax\n"                // EFER.LME
+    "    wrmsr\n"
+    "    movl $0x80010033, %eax\n"          // PG | WP | NE | ET | MP | PE
+    "    movl %eax, %cr0\n"
+    "    ljmpl *48\n"
+    ".code64\n"
+    "ap_trampoline_long:\n"
+    "    movl $0x10, %eax\n"
+    "    movl %eax, %ds\n"
+    "    movl %eax, %es\n"
+    "    movl %eax, %ss\n"
+    "    xorl %eax, %eax\n"
+    "    movl %eax, %fs\n"
+    "    movl %eax, %gs\n"
+    // Same as get_apic_id().
+    "    cpuid\n"
+    "    cmpl $0xB, %eax\n"
+    "    jb 2f\n"
+    "    movl $0xB, %eax\n"
+    "    xorl %ecx, %ecx\n"
+    "    cpuid\n"
+    "    movl %edx, %r8d\n"
+    "    testl %ebx, %ebx\n"
+    "    jnz 3f\n"
+    "2:  movl $1, %eax\n"
+    "    cpuid\n"
+    "    shrl $24, %ebx\n"
+    "    movl %ebx, %r8d\n"
+    "3:  movq ap_trampoline_data(%rip), %rdi\n"
+    "    movq ap_trampoline_data+8(%rip), %rcx\n"
+    "4:  testq %rcx, %rcx\n"
+    "    jz 8f\n"
+    "    cmpl %r8d, (%rdi)\n"               // apic_id
+    "    jne 5f\n"
+    "    testl $1, 4(%rdi)\n"               // CPU_BSP
+    "    jz 6f\n"
+    "5:  addq $64, %rdi\n"
+    "    decq %rcx\n"
+    "    jmp 4b\n"
+    "6:  movq 24(%rdi), %rsp\n"             // stack_top
+    "    lock orl $2, 4(%rdi)\n"            // CPU_PARKED
+    "    movq ap_trampoline_data+16(%rip), %rsi\n"
+    "7:  movq 8(%rdi), %rbx\n"              // goto_address
+    "    testq %rbx, %rbx\n"
+    "    jnz 9f\n"
+    "    movq (%rsi), %rbx\n"               // *release_all
+    "    testq %rbx, %rbx\n"
+    "    jnz 9f\n"
+    "    pause\n"
+    "    jmp 7b\n"
+    "9:  movq 32(%rdi), %rax\n"             // percpu
+    "    testq %rax, %rax\n"
+    "    jz 10f\n"
+    "    movq %rax, %rdx\n"
+    "    shrq $32, %rdx\n"
+    "    movl $0xC0000101, %ecx\n"          // MSR_GS_BASE
+    "    wrmsr\n"
+    "10: xorl %ebp, %ebp\n"
+    "    callq *%rbx\n"                     // rsp = stack_top - 8 at entry, as the ABI wants.
+    "8:  cli\n"
+    "    hlt\n"
+    "    jmp 8b\n"
+    "ap_trampoline_end:\n"
+);
+
+extern char ap_trampoline[], ap_trampoline_long[], ap_trampoline_end[];
+
+
+// Copies the AP trampoline to a page below 1 MiB and fills in its data block.
+void setup_ap_startup(EFI_SYSTEM_TABLE* sysTable) {
+    EFI_PHYSICAL_ADDRESS page = AP_STARTUP_MAX_ADDRESS;
+    uint64_t cr3, cr4;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r" (cr3));
+    __asm__ __volatile__("mov %%cr4, %0" : "=r" (cr4));
+
+    // The APs load CR3 while still in 32-bit code, a root above 4 GiB cannot be reached.
+    if (cr3 >> 32) {
+        const char* msg = "Page tables above 4 GiB, APs will not be started.\n";
+        boot_log_write(msg);
+        serial_write(msg);
+        return;
+    }
+
+    if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateMaxAddress, AP_STARTUP_MEMORY_TYPE, 1, &page))) {
+        page = AP_STARTUP_MAX_ADDRESS;
+        if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateMaxAddress, EfiLoaderData, 1, &page))) {
+            return;
+        }
+    }
+
+    CopyMem((void*)page, ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    struct ApTrampolineData* data = (struct ApTrampolineData*)(page + AP_TRAMPOLINE_DATA);
+    data->cpus = (uint64_t)runtime_services.smp.cpus;
+    data->cpu_count = runtime_services.smp.cpu_count;
+    data->release_all = (uint64_t)runtime_services.smp.release_all;
+    data->efer = rdmsr(MSR_EFER) & ~EFER_LMA;
+    data->cr3 = (uint32_t)cr3;
+    data->cr4 = (cr4 & AP_CR4_MASK) | CR4_PAE;
+    data->long_entry = page + (ap_trampoline_long - ap_trampoline);
+    data->code_sel = 0x08;
+    data->gdt_limit = sizeof(data->gdt) - 1;
+    data->gdt_base = page + AP_TRAMPOLINE_DATA + __builtin_offsetof(struct ApTrampolineData, gdt);
+    data->gdt[0] = 0;
+    data->gdt[1] = 0x00AF9A000000FFFF;      // 64-bit code.
+    data->gdt[2] = 0x00CF92000000FFFF;      // Data.
+
+    runtime_services.ap_startup.page = page;
+    runtime_services.ap_startup.cr3 = (uint32_t*)(page + AP_TRAMPOLINE_DATA + __builtin_offsetof(struct ApTrampolineData, cr3));
+}
+
+
+/*
+ *  Enumerates the CPUs with MP services, gives each one
+ *  a stack and per-CPU area and sets up the page the kernel
+ *  starts the APs on.
+ *
+ *  The APs are not started here: anything parked through MP
+ *  services is pulled back into the firmware's own loop at
+ *  ExitBootServices (EDK2's MpInitLib sends them INIT-SIPI-SIPI).
+ *
+ *  If MP services is not available only the BSP is listed.
+ *
+ */
+
+void setup_cpus(EFI_SYSTEM_TABLE* sysTable) {
+    EFI_MP_SERVICES_PROTOCOL* mp = NULL;
+    UINTN n_cpus = 1, n_enabled = 1;
+
+    EFI_STATUS status = uefi_call_wrapper(sysTable->BootServices->LocateProtocol, 3, &gEfiMpServicesProtocolGuid, NULL, (void**)&mp);
+    if (EFI_ERROR(status) || EFI_ERROR(uefi_call_wrapper(mp->GetNumberOfProcessors, 3, mp, &n_cpus, &n_enabled))) {
+        mp = NULL;
+        n_cpus = 1;
+    }
+
+    // CpuInfo array and the release word, then one stack and per-CPU area per CPU.
+    UINTN info_size = EFI_SIZE_TO_PAGES((n_cpus + 1) * sizeof(struct CpuInfo)) * EFI_PAGE_SIZE;
+    UINTN stacks_size = n_cpus * AP_STACK_PAGES * EFI_PAGE_SIZE;
+    UINTN percpu_size = PERCPU_PAGES * EFI_PAGE_SIZE;
+    UINTN pages = EFI_SIZE_TO_PAGES(info_size + stacks_size) + n_cpus * PERCPU_PAGES;
+    EFI_PHYSICAL_ADDRESS base;
+
+    if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, pages, &base))) {
+        return;
+    }
+
+    ZeroMem((void*)base, info_size);
+    runtime_services.smp.cpus = (struct CpuInfo*)base;
+    runtime_services.smp.release_all = (volatile uint64_t*)&runtime_services.smp.cpus[n_cpus];
+    runtime_services.smp.percpu_size = percpu_size;
+
+    // CPUs MP services cannot describe are left out, an empty entry would claim APIC ID 0.
+    UINTN i = 0;
+    for (UINTN n = 0; n < n_cpus; ++n) {
+        struct CpuInfo* cpu = &runtime_services.smp.cpus[i];
+        EFI_PROCESSOR_INFORMATION info;
+
+        if (!mp) {
+            info.ProcessorId = get_apic_id();
+            info.StatusFlag = PROCESSOR_AS_BSP_BIT | PROCESSOR_ENABLED_BIT;
+        } else if (EFI_ERROR(uefi_call_wrapper(mp->GetProcessorInfo, 3, mp, n, &info))) {
+            continue;
+        }
+
+        cpu->apic_id = info.ProcessorId;
+        cpu->stack_top = base + info_size + (i + 1) * AP_STACK_PAGES * EFI_PAGE_SIZE;
+
+        if (percpu_size) {
+            // First qword is a self pointer so the kernel can read its area through %gs:0.
+            cpu->percpu = base + info_size + stacks_size + i * percpu_size;
+            ZeroMem((void*)cpu->percpu, percpu_size);
+            *(uint64_t*)cpu->percpu = cpu->percpu;
+        }
+
+        if (info.StatusFlag & PROCESSOR_AS_BSP_BIT) {
+            cpu->flags |= CPU_BSP;
+            runtime_services.smp.bsp_apic_id = cpu->apic_id;
+        }
+
+        ++i;
+    }
+
+    runtime_services.smp.cpu_count = i;
+
+#if START_APS
+    if (i > 1) setup_ap_startup(sysTable);
+#endif
+}
+
+
+// Allocates the kernel stack with a poisoned guard page below it.
+void alloc_kernel_stack(EFI_SYSTEM_TABLE* sysTable) {
+    EFI_PHYSICAL_ADDRESS base;
+
+    // Kernel stays on the firmware stack if this fails.
+    if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, KERNEL_STACK_PAGES + 1, &base))) {
+        return;
+    }
+
+    SetMem((void*)base, EFI_PAGE_SIZE, STACK_GUARD_BYTE);
+    runtime_services.kernel_stack.guard = base;
+    runtime_services.kernel_stack.base = base + EFI_PAGE_SIZE;
+    runtime_services.kernel_stack.top = base + (KERNEL_STACK_PAGES + 1) * EFI_PAGE_SIZE;
+}
+
+
+// Moves the runtime regions to PhysicalStart + RUNTIME_VIRT_OFFSET so the kernel
+// can keep calling runtime services after it drops the identity map.
+// Only valid after ExitBootServices, and only once.
+void set_virtual_map(EFI_SYSTEM_TABLE* sysTable, UINT32 descVersion) {
+    EFI_RUNTIME_SERVICES* rt = sysTable->RuntimeServices;
+    uint64_t entries = get_mmap_entries();
+
+    for (uint64_t i = 0; i < entries; ++i) {
+        EFI_MEMORY_DESCRIPTOR* desc = mmap_iterator_helper(i);
+        desc->VirtualStart = (desc->Attribute & EFI_MEMORY_RUNTIME) ? desc->PhysicalStart + RUNTIME_VIRT_OFFSET : 0;
+    }
+
+    if (EFI_ERROR(uefi_call_wrapper(rt->SetVirtualAddressMap, 4, runtime_services.mmap.mapSize, runtime_services.mmap.mapDescSize, descVersion, runtime_services.mmap.map))) {
+        return;
+    }
+
+    // The table itself lives in runtime memory, so it moved with the rest.
+    runtime_services.efi_runtime.rt = (EFI_RUNTIME_SERVICES*)((uint64_t)rt + RUNTIME_VIRT_OFFSET);
+    runtime_services.efi_runtime.virt_offset = RUNTIME_VIRT_OFFSET;
+}
+
+
+// Fetches the final memory map and exits boot services.
+// Once ExitBootServices has failed only GetMemoryMap and ExitBootServices may be called, so the
+// buffer is sized and allocated once up front; a retry only refetches the map into it.
+EFI_STATUS exit_boot_services(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    EFI_MEMORY_DESCRIPTOR* map = NULL;
+    UINTN bufferSize, mapSize = 0, mapKey, descSize;
+    UINT32 descVersion;
+    EFI_STATUS status;
+
+    status = uefi_call_wrapper(sysTable->BootServices->GetMemoryMap, 5, &mapSize, map, &mapKey, &descSize, &descVersion);
+    if (status != EFI_BUFFER_TOO_SMALL) {
+        return EFI_ERROR(status) ? status : EFI_LOAD_ERROR;
+    }
+
+    // Slack for the descriptors our own allocation, trimming the arena and the firmware's timer
+    // events add before the map is final. There is no growing the buffer later.
+    // Taking it from the arena leaves the map alone. The rest of the arena goes back here, once:
+    // trimming frees pages, so it must not run between a GetMemoryMap and ExitBootServices.
+    bufferSize = mapSize + mapSize / 4 + 16 * descSize;
+    map = LibArenaAllocate(&loader_arena, bufferSize, 0);
+
+    if (!map && EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePool, 3, EfiLoaderData, bufferSize, (void**)&map))) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    LibArenaTrim(&loader_arena);
+
+    for (uint32_t attempt = 0; attempt < 8; ++attempt) {
+        mapSize = bufferSize;
+        status = uefi_call_wrapper(sysTable->BootServices->GetMemoryMap, 5, &mapSize, map, &mapKey, &descSize, &descVersion);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        runtime_services.mmap.map = map;
+        runtime_services.mmap.mapSize = mapSize;
+        runtime_services.mmap.mapDescSize = descSize;
+
+        status = uefi_call_wrapper(sysTable->BootServices->ExitBootServices, 2, imageHandle, mapKey);
+        if (!EFI_ERROR(status)) {
+            break;
+        }
+    }
+
+    if (!EFI_ERROR(status) && SET_VIRTUAL_MAP) {
+        set_virtual_map(sysTable, descVersion);
+    }
+
+    return status;
+}
+
+
+static void __attribute__((noreturn, used)) enter_kernel(void) {
+    for (uint64_t i = 0; i < runtime_services.smp.cpu_count; ++i) {
+        struct CpuInfo* cpu = &runtime_services.smp.cpus[i];
+        if ((cpu->flags & CPU_BSP) && cpu->percpu) {
+            wrmsr(MSR_GS_BASE, cpu->percpu);
+        }
+    }
+
+    kernel_entry(runtime_services);
+
+    while (1) {
+        __asm__ __volatile__("cli; hlt");
+    }
+}
+
+
+// Switches to the kernel stack (if we have one) and calls the kernel.
+void __attribute__((noreturn)) jump_to_kernel(void) {
+    if (runtime_services.kernel_stack.top) {
+        __asm__ __volatile__("mov %0, %%rsp; xor %%ebp, %%ebp; call *%1" : : "r" (runtime_services.kernel_stack.top), "r" (enter_kernel) : "memory");
+    }
+
+    enter_kernel();
+}
+
+
 size_t strlen(const char* str) {
     size_t n = 0;
     while (str[n++]);
@@ -187,30 +1281,242 @@ EFI_FILE* load_file(EFI_FILE* directory, CHAR16* path, EFI_HANDLE imageHandle, E
 }
 
 
-UINT64 getFileSize(EFI_HANDLE imageHandle, CHAR16* path) {
-    EFI_FILE_HANDLE fileHandle;
-    EFI_FILE_HANDLE volume = get_volume(imageHandle);
-    uefi_call_wrapper(volume->Open, 5, volume, &fileHandle, path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
-    UINT64 ret;
-    EFI_FILE_INFO* fileinfo = LibFileInfo(fileHandle);
-    ret = fileinfo->FileSize;
-    FreePool(fileinfo);                 // Free memory.
-    return ret;
+/*
+ *  Reads a whole file into freshly allocated pages
+ *  with a single Read call, then closes it.
+ *
+ *  Returns NULL if the file could not be read.
+ *
+ */
+
+void* read_open_file(EFI_FILE* file, UINTN* size, EFI_SYSTEM_TABLE* sysTable) {
+    EFI_PHYSICAL_ADDRESS buffer;
+
+    if (!(file)) return NULL;
+
+    // The info is only needed for the size, so it goes back to the arena right away.
+    UINTN mark = LibArenaMark(&loader_arena);
+    UINTN infoSize = SIZE_OF_EFI_FILE_INFO + CONFIG_PATH_LEN * sizeof(CHAR16);
+    EFI_FILE_INFO* info = LibArenaAllocate(&loader_arena, infoSize, 0);
+    EFI_FILE_INFO* pooled = NULL;
+
+    if (!(info)
+        || EFI_ERROR(uefi_call_wrapper(file->GetInfo, 4, file, &GenericFileInfo, &infoSize, info))) {
+        info = pooled = LibFileInfo(file);
+    }
+
+    if (!(info)) {
+        LibArenaReset(&loader_arena, mark);
+        uefi_call_wrapper(file->Close, 1, file);
+        return NULL;
+    }
+
+    *size = info->FileSize;
+    if (pooled) FreePool(pooled);
+    LibArenaReset(&loader_arena, mark);
+
+    if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(*size + 1), &buffer))) {
+        uefi_call_wrapper(file->Close, 1, file);
+        return NULL;
+    }
+
+    EFI_STATUS status = uefi_call_wrapper(file->Read, 3, file, size, (void*)buffer);
+    uefi_call_wrapper(file->Close, 1, file);
+
+    if (EFI_ERROR(status)) {
+        uefi_call_wrapper(sysTable->BootServices->FreePages, 2, buffer, EFI_SIZE_TO_PAGES(*size + 1));
+        return NULL;
+    }
+
+    ((char*)buffer)[*size] = '\0';
+    return (void*)buffer;
+}
+
+
+void* read_file(CHAR16* path, UINTN* size, EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    return read_open_file(load_file(NULL, path, imageHandle, sysTable), size, sysTable);
+}
+
+
+struct BMP* load_wallpaper(CHAR16* path, EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    UINTN read_size;
+    return read_file(path, &read_size, imageHandle, sysTable);
 }
 
 
-struct BMP* load_wallpaper(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
-    struct BMP* bmp = NULL;
+// Copies at most len - 1 characters of an ASCII string and terminates it.
+static void config_copy(char* dst, const char* src, UINTN len) {
+    UINTN i = 0;
+    for (; src[i] && i < len - 1; ++i) {
+        dst[i] = src[i];
+    }
 
-    UINTN read_size = getFileSize(imageHandle, WALLPAPER_PATH);
-    EFI_FILE* bmp_file_handle = load_file(NULL, WALLPAPER_PATH, imageHandle, sysTable);
-    sysTable->BootServices->AllocatePool(EfiLoaderData, read_size, (void**)&bmp);
-    
-    // Check if failure to allocate memory.
-    if (bmp == NULL) return NULL;
+    dst[i] = '\0';
+}
+
+
+// Same as config_copy but widens to UCS-2 for EFI file paths.
+static void config_copy_path(CHAR16* dst, const char* src) {
+    UINTN i = 0;
+    for (; src[i] && i < CONFIG_PATH_LEN - 1; ++i) {
+        dst[i] = src[i] == '/' ? L'\\' : (CHAR16)src[i];
+    }
+
+    dst[i] = L'\0';
+}
+
+
+static int32_t config_int(const char* value) {
+    int32_t sign = 1, n = 0;
+
+    if (*value == '-') {
+        sign = -1;
+        ++value;
+    }
+
+    for (; *value >= '0' && *value <= '9'; ++value) {
+        n = n * 10 + (*value - '0');
+    }
+
+    return sign * n;
+}
+
+
+static void config_set(char* key, char* value, struct BootEntry** entry) {
+    #define KEY(k) (strcmpa((CHAR8*)key, (CHAR8*)k) == 0)
+
+    // Starts a new boot entry, the keys after it belong to it.
+    if (KEY("entry")) {
+        if (boot_options.n_entries >= MAX_BOOT_ENTRIES) {
+            *entry = NULL;
+            return;
+        }
+
+        *entry = &boot_options.entries[boot_options.n_entries++];
+        config_copy((*entry)->name, value, sizeof((*entry)->name));
+        config_copy_path((*entry)->kernel_path, "kernel.elf");
+    } else if (*entry && KEY("kernel")) {
+        config_copy_path((*entry)->kernel_path, value);
+    } else if (*entry && KEY("cmdline")) {
+        config_copy((*entry)->cmdline, value, sizeof((*entry)->cmdline));
+    } else if (*entry && KEY("module")) {
+        if ((*entry)->n_modules < MAX_MODULES) {
+            config_copy_path((*entry)->modules[(*entry)->n_modules++], value);
+        }
+    } else if (*entry && KEY("video")) {
+        // WIDTHxHEIGHT.
+        (*entry)->video_width = config_int(value);
+        while (*value && *value != 'x') ++value;
+        (*entry)->video_height = *value ? config_int(value + 1) : 0;
+    } else if (KEY("timeout")) {
+        boot_options.timeout = config_int(value);
+    } else if (KEY("default")) {
+        boot_options.default_entry = config_int(value);
+    } else if (KEY("quiet")) {
+        boot_options.quiet = config_int(value);
+    } else if (KEY("verbose")) {
+        boot_options.verbose = config_int(value);
+    } else if (KEY("use_wallpaper")) {
+        boot_options.use_wallpaper = config_int(value);
+    } else if (KEY("draw_outline")) {
+        boot_options.draw_outline = config_int(value);
+    } else if (KEY("serial")) {
+        boot_options.serial = config_int(value);
+    } else if (KEY("wallpaper")) {
+        config_copy_path(boot_options.wallpaper_path, value);
+    } else if (KEY("font")) {
+        config_copy_path(boot_options.font_path, value);
+    } else if (KEY("dev")) {
+        boot_options.dev = strcmpa((CHAR8*)value, (CHAR8*)"serial") == 0 ? DEV_SERIAL
+                         : strcmpa((CHAR8*)value, (CHAR8*)"drive") == 0 ? DEV_DRIVE : DEV_OFF;
+    }
+
+    #undef KEY
+}
+
+
+/*
+ *  Parses key=value lines in one pass over the buffer.
+ *
+ *  Lines starting with '#' are comments, an "entry=NAME"
+ *  line starts a new boot entry and kernel, cmdline, module
+ *  and video lines after it apply to that entry.
+ *
+ */
+
+void parse_config(char* buf, UINTN size) {
+    struct BootEntry* entry = NULL;
+    char* end = buf + size;
+
+    while (buf < end) {
+        char* line = buf;
+        char* eq = NULL;
+
+        for (; buf < end && *buf != '\n'; ++buf) {
+            if (*buf == '=' && !eq) eq = buf;
+        }
+
+        char* line_end = buf++;
+        while (line_end > line && (line_end[-1] == '\r' || line_end[-1] == ' ' || line_end[-1] == '\t')) --line_end;
+        while (line < line_end && (*line == ' ' || *line == '\t')) ++line;
+
+        if (line == line_end || *line == '#' || !eq || eq >= line_end) continue;
+
+        char* key_end = eq;
+        while (key_end > line && (key_end[-1] == ' ' || key_end[-1] == '\t')) --key_end;
+        char* value = eq + 1;
+        while (value < line_end && (*value == ' ' || *value == '\t')) ++value;
+
+        *key_end = '\0';
+        *line_end = '\0';
+        config_set(line, value, &entry);
+    }
+}
+
+
+// Reads CONFIG_PATH if it exists, there is always at least one entry afterwards.
+void load_config(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    UINTN size;
+    char* buf = read_file(CONFIG_PATH, &size, imageHandle, sysTable);
+
+    if (buf) {
+        parse_config(buf, size);
+        uefi_call_wrapper(sysTable->BootServices->FreePages, 2, (EFI_PHYSICAL_ADDRESS)buf, EFI_SIZE_TO_PAGES(size + 1));
+    }
+
+    if (boot_options.n_entries == 0) {
+        config_copy(boot_options.entries[0].name, "FacelessOS", CONFIG_PATH_LEN);
+        StrCpy(boot_options.entries[0].kernel_path, KERNEL_PATH);
+        boot_options.n_entries = 1;
+    }
+
+    if (boot_options.default_entry >= boot_options.n_entries) {
+        boot_options.default_entry = 0;
+    }
+}
 
-    bmp_file_handle->Read(bmp_file_handle, &read_size, bmp);
-    return bmp;
+
+// Loads every module of a boot entry into memory for the kernel.
+void load_modules(struct BootEntry* entry, EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    runtime_services.modules.list = boot_modules;
+    runtime_services.modules.count = 0;
+
+    for (uint32_t i = 0; i < entry->n_modules; ++i) {
+        struct BootModule* module = &boot_modules[runtime_services.modules.count];
+        UINTN size;
+
+        module->base = read_file(entry->modules[i], &size, imageHandle, sysTable);
+        if (!(module->base)) continue;
+
+        module->size = size;
+        UINTN j = 0;
+        for (; entry->modules[i][j] && j < CONFIG_PATH_LEN - 1; ++j) {
+            module->path[j] = (char)entry->modules[i][j];
+        }
+
+        module->path[j] = '\0';
+        ++runtime_services.modules.count;
+    }
 }
 
 
@@ -224,7 +1530,11 @@ void load_font(EFI_FILE* dir, CHAR16* path, EFI_HANDLE imageHandle, EFI_SYSTEM_T
     }
 
     // Allocate memory for our font.
-    sysTable->BootServices->AllocatePool(EfiLoaderData, PSF1_HEADER_SIZE, (void**)&runtime_services.psf1_font_header);
+    runtime_services.psf1_font_header = LibArenaAllocate(&loader_arena, PSF1_HEADER_SIZE, 0);
+    if (!(runtime_services.psf1_font_header)) {
+        font->Close(font);
+        return;
+    }
     UINTN header_size = PSF1_HEADER_SIZE;
     font->Read(font, &header_size, runtime_services.psf1_font_header);
 
@@ -239,15 +1549,24 @@ void load_font(EFI_FILE* dir, CHAR16* path, EFI_HANDLE imageHandle, EFI_SYSTEM_T
        glyphBufferSize = runtime_services.psf1_font_header->chsize * 512; 
     }
 
-    void* glyphBuffer = NULL;
     font->SetPosition(font, PSF1_HEADER_SIZE);
-    sysTable->BootServices->AllocatePool(EfiLoaderData, glyphBufferSize, (void**)&glyphBuffer);
+    void* glyphBuffer = LibArenaAllocate(&loader_arena, glyphBufferSize, 0);
+    if (!(glyphBuffer)) {
+        runtime_services.psf1_font_header = NULL;
+        font->Close(font);
+        return;
+    }
 
     // Read glpyhs into memory.
     font->Read(font, &glyphBufferSize, glyphBuffer);
     
     // Allocate memory for font.
-    sysTable->BootServices->AllocatePool(EfiLoaderData, glyphBufferSize+PSF1_HEADER_SIZE, (void**)&runtime_services.psf1_font);
+    runtime_services.psf1_font = LibArenaAllocate(&loader_arena, sizeof(*runtime_services.psf1_font), 0);
+    if (!(runtime_services.psf1_font)) {
+        runtime_services.psf1_font_header = NULL;
+        font->Close(font);
+        return;
+    }
 
     // Set font glpyh buffer.
     runtime_services.psf1_font->glyphBuffer = glyphBuffer;
@@ -359,6 +1678,8 @@ void blit_wallpaper(uint32_t xpos, uint32_t ypos) {
 
 
 void term_write(const char* str, uint32_t color) {
+    serial_write(str);
+
     // Save old canvas position.
     uint32_t old_canvas_x = runtime_services.canvas.x, old_canvas_y = runtime_services.canvas.y;
     // Set canvas position to where we want to write on terminal.
@@ -423,38 +1744,37 @@ void display_terminal(uint32_t xpos, uint32_t ypos) {
         }
     }
 
-#if DRAW_OUTLINE
-    // Draw a cool outline on the window.
-    // Draw down on left side of window.
-    uint32_t edge_distance = 4;                   // Distance of outline to outer edges of window.
+    if (boot_options.draw_outline) {
+        // Draw a cool outline on the window.
+        // Draw down on left side of window.
+        uint32_t edge_distance = 4;                   // Distance of outline to outer edges of window.
 
-    if (boot_mode) {
-        edge_distance = 20;
-    }
+        if (boot_mode) {
+            edge_distance = 20;
+        }
         
-    const uint32_t OUTLINE_COLOR = 0x808080;
-    for (uint64_t y = ypos + edge_distance; y < HEIGHT - edge_distance; ++y) {
-        screen[get_pixel_idx(xpos + edge_distance, y)] = OUTLINE_COLOR;
-    }
+        const uint32_t OUTLINE_COLOR = 0x808080;
+        for (uint64_t y = ypos + edge_distance; y < HEIGHT - edge_distance; ++y) {
+            screen[get_pixel_idx(xpos + edge_distance, y)] = OUTLINE_COLOR;
+        }
 
-    // Draw right on bottom of window.
-    for (uint64_t x = xpos + edge_distance; x < WIDTH - edge_distance; ++x) {
-        screen[get_pixel_idx(x, HEIGHT - edge_distance)] = OUTLINE_COLOR;
-    }
+        // Draw right on bottom of window.
+        for (uint64_t x = xpos + edge_distance; x < WIDTH - edge_distance; ++x) {
+            screen[get_pixel_idx(x, HEIGHT - edge_distance)] = OUTLINE_COLOR;
+        }
 
-    // Draw up on right of window.
-    for (uint64_t y = HEIGHT - edge_distance; y > ypos + edge_distance; --y) {
-        screen[get_pixel_idx(WIDTH - edge_distance, y)] = OUTLINE_COLOR;
-    }
+        // Draw up on right of window.
+        for (uint64_t y = HEIGHT - edge_distance; y > ypos + edge_distance; --y) {
+            screen[get_pixel_idx(WIDTH - edge_distance, y)] = OUTLINE_COLOR;
+        }
 
-     // Draw right on top of window.
-     // Now we will have an outline!
-    for (uint64_t x = xpos + edge_distance; x < WIDTH - edge_distance; ++x) {
-        screen[get_pixel_idx(x, ypos + edge_distance)] = OUTLINE_COLOR;
+         // Draw right on top of window.
+         // Now we will have an outline!
+        for (uint64_t x = xpos + edge_distance; x < WIDTH - edge_distance; ++x) {
+            screen[get_pixel_idx(x, ypos + edge_distance)] = OUTLINE_COLOR;
+        }
     }
 
-#endif
-
     // Draw title bar.
     if (boot_mode) {
         size_t title_length = strlen(TITLE);
@@ -474,17 +1794,267 @@ void display_wallpaper(void) {
 
 
 void refresh_wallpaper(void) {
+    if (!runtime_services.wallpaper) return;
     blit_wallpaper(runtime_services.framebuffer_data.width + (runtime_services.wallpaper->info_header.width), runtime_services.wallpaper->info_header.height/3);
 }
 
 
 
 void read_wallpaper_data(struct BMP* bmp) {
-#if VERBOSE
+    if (!boot_options.verbose) return;
     Print(L"Wallpaper filesize is %d Bytes.\n", bmp->header.file_size);
     Print(L"Wallpaper width is %d pixels.\n", bmp->info_header.width);
     Print(L"Wallpaper height is %d pixels.\n", bmp->info_header.height);
-#endif
+}
+
+
+// Loader progress text, dropped in quiet mode.
+void loader_write(const char* str, uint32_t color) {
+    boot_log_write(str);
+
+    // Headless boots still get their log on serial.
+    if (boot_options.quiet) {
+        serial_write(str);
+        return;
+    }
+
+    term_write(str, color);
+}
+
+
+// Framebuffer text for the kernel, mirrored to serial.
+void framebuffer_write(const char* str, uint32_t color, uint32_t restore_to) {
+    serial_write(str);
+    lfb_write(str, color, restore_to);
+}
+
+
+// Clears the boot menu window, does nothing without a wallpaper.
+void redraw_terminal(void) {
+    if (boot_options.quiet || !runtime_services.wallpaper) return;
+    refresh_wallpaper();
+    display_terminal(250, 50);
+}
+
+
+// Shows a fatal loader error and stops the machine.
+void __attribute__((noreturn)) loader_halt(const char* str) {
+    redraw_terminal();
+    loader_write(str, 0xFF0000);
+    while (1) {
+        __asm__ __volatile__("cli; hlt");
+    }
+}
+
+
+static char* menu_append(char* dst, char* end, const char* src) {
+    while (*src && dst < end - 1) *dst++ = *src++;
+    *dst = '\0';
+    return dst;
+}
+
+
+/*
+ *  Draws one line per boot entry followed by the reset items.
+ *
+ *  @selected: Highlighted item, reset items start at n_entries.
+ *  @edit: Command line being edited, NULL if not editing.
+ *  @clear: Redraw the window first.
+ *
+ */
+
+void draw_menu(uint32_t selected, const char* edit, uint8_t clear) {
+    const size_t MAX_EDIT_SHOWN = 80;
+    char text[1024];
+    char* p = text;
+    char* end = text + sizeof(text);
+
+    if (boot_options.quiet) return;
+    if (clear) redraw_terminal();
+
+    for (uint32_t i = 0; i < boot_options.n_entries + N_RESET_ITEMS; ++i) {
+        p = menu_append(p, end, "\n\t\t\t");
+        p = menu_append(p, end, i < boot_options.n_entries ? boot_options.entries[i].name : reset_items[i - boot_options.n_entries].name);
+        p = menu_append(p, end, i == selected ? " [X]\n" : " []\n");
+    }
+
+    if (edit) {
+        // Only the tail fits in the window.
+        size_t len = strlen(edit);
+        p = menu_append(p, end, "\n\t\t\tcmdline: ");
+        p = menu_append(p, end, len > MAX_EDIT_SHOWN ? edit + len - MAX_EDIT_SHOWN : edit);
+        p = menu_append(p, end, "_");
+    } else if (selected < boot_options.n_entries) {
+        p = menu_append(p, end, "\n\t\t\t'e' to edit the command line");
+    }
+
+    term_write(text, 0x7DF9FF);
+}
+
+
+// Reads quiet, verbose, serial, noserial, dev=serial, dev=drive, nowallpaper and timeout=N from the loader's command line.
+void parse_load_options(EFI_HANDLE imageHandle) {
+    CHAR16** argv;
+    INTN argc = GetShellArgcArgv(imageHandle, &argv);
+
+    for (INTN i = 1; i < argc; ++i) {
+        if (StrCmp(argv[i], L"quiet") == 0) {
+            boot_options.quiet = 1;
+        } else if (StrCmp(argv[i], L"verbose") == 0) {
+            boot_options.verbose = 1;
+        } else if (StrCmp(argv[i], L"serial") == 0) {
+            boot_options.serial = 1;
+        } else if (StrCmp(argv[i], L"noserial") == 0) {
+            boot_options.serial = 0;
+        } else if (StrCmp(argv[i], L"dev=serial") == 0) {
+            boot_options.dev = DEV_SERIAL;
+        } else if (StrCmp(argv[i], L"dev=drive") == 0) {
+            boot_options.dev = DEV_DRIVE;
+        } else if (StrCmp(argv[i], L"nowallpaper") == 0) {
+            boot_options.use_wallpaper = 0;
+        } else if (StrnCmp(argv[i], L"timeout=", 8) == 0) {
+            boot_options.timeout = argv[i][8] == L'-' ? -1 : (int32_t)Atoi(argv[i] + 8);
+        }
+    }
+
+    if (boot_options.quiet) {
+        boot_options.use_wallpaper = 0;
+        boot_options.timeout = 0;
+    }
+}
+
+
+static uint8_t dev_read_u32(uint32_t* value) {
+    uint8_t c;
+    *value = 0;
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        if (!serial_read(&c, 1000000)) return 0;
+        *value |= (uint32_t)c << (i * 8);
+    }
+
+    return 1;
+}
+
+
+/*
+ *  Receives the kernel over serial.
+ *
+ *  The loader sends "FDEV?\n" once a second and the host
+ *  answers with a little endian header, then the image:
+ *
+ *      u32 magic ("FDEV"), u32 length, u32 crc32, u32 ~length
+ *
+ *  The loader replies "FDEV+\n" when the CRC matches and
+ *  "FDEV-\n" when it does not, the host then sends it again.
+ *  kernel/devsend.py is the host side.
+ *
+ */
+
+void* dev_receive_serial(UINTN* size, EFI_SYSTEM_TABLE* sysTable) {
+    if (!runtime_services.serial.port) return NULL;
+
+    loader_write("Waiting for a kernel on serial...\n", 0xFFEA00);
+
+    for (uint32_t attempt = 0; attempt < DEV_RETRIES; ++attempt) {
+        uint32_t magic = 0, length, crc, check;
+        uint8_t c;
+
+        // Ask until the magic shows up, anything before it is line noise.
+        for (uint32_t waited = 0; magic != DEV_MAGIC; ) {
+            if (!serial_read(&c, 1000000)) {
+                if (++waited > DEV_SERIAL_TIMEOUT) return NULL;
+                serial_write("FDEV?\n");
+                serial_flush();
+                continue;
+            }
+
+            magic = (magic >> 8) | ((uint32_t)c << 24);
+        }
+
+        if (!dev_read_u32(&length) || !dev_read_u32(&crc) || !dev_read_u32(&check)
+            || check != ~length || length == 0 || length > DEV_MAX_SIZE) {
+            serial_write("FDEV-\n");
+            serial_flush();
+            continue;
+        }
+
+        EFI_PHYSICAL_ADDRESS buffer;
+        if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(length), &buffer))) {
+            return NULL;
+        }
+
+        uint8_t* image = (uint8_t*)buffer;
+        uint32_t received = 0;
+        while (received < length && serial_read(&image[received], 1000000)) {
+            ++received;
+        }
+
+        if (received == length && CalculateCrc(image, length) == crc) {
+            serial_write("FDEV+\n");
+            serial_flush();
+            *size = length;
+            return image;
+        }
+
+        uefi_call_wrapper(sysTable->BootServices->FreePages, 2, buffer, EFI_SIZE_TO_PAGES(length));
+        serial_write("FDEV-\n");
+        serial_flush();
+    }
+
+    return NULL;
+}
+
+
+// Reads path from the first FAT volume that is not the one we booted from.
+void* dev_read_drive(CHAR16* path, UINTN* size, EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    EFI_LOADED_IMAGE* loaded_image = NULL;
+    EFI_HANDLE* handles;
+    UINTN n_handles;
+    void* image = NULL;
+
+    uefi_call_wrapper(sysTable->BootServices->HandleProtocol, 3, imageHandle, &gEfiLoadedImageProtocolGuid, (void**)&loaded_image);
+    if (EFI_ERROR(LibLocateHandle(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &n_handles, &handles))) {
+        return NULL;
+    }
+
+    for (UINTN i = 0; i < n_handles && !image; ++i) {
+        EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs;
+        EFI_FILE* volume;
+        EFI_FILE* file;
+
+        if (handles[i] == loaded_image->DeviceHandle) continue;
+        if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->HandleProtocol, 3, handles[i], &gEfiSimpleFileSystemProtocolGuid, (void**)&fs))) continue;
+        if (EFI_ERROR(uefi_call_wrapper(fs->OpenVolume, 2, fs, &volume))) continue;
+
+        if (!EFI_ERROR(uefi_call_wrapper(volume->Open, 5, volume, &file, path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY))) {
+            image = read_open_file(file, size, sysTable);
+        }
+
+        uefi_call_wrapper(volume->Close, 1, volume);
+    }
+
+    FreePool(handles);
+    return image;
+}
+
+
+// Kernel from the dev source if there is one, else from the boot volume.
+void* read_kernel(struct BootEntry* entry, UINTN* size, EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    void* image = NULL;
+
+    if (boot_options.dev == DEV_SERIAL) {
+        image = dev_receive_serial(size, sysTable);
+    } else if (boot_options.dev == DEV_DRIVE) {
+        image = dev_read_drive(entry->kernel_path, size, imageHandle, sysTable);
+    }
+
+    if (image) {
+        loader_write("Kernel loaded from the dev source.\n", 0xFFEA00);
+        return image;
+    }
+
+    return read_file(entry->kernel_path, size, imageHandle, sysTable);
 }
 
 
@@ -512,157 +2082,231 @@ int memcmp(const void* aptr, const void* bptr, size_t n) {
  */
 
 EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* sysTable) {
+    runtime_services.timebase.boot_tsc = rdtsc();
     InitializeLib(imageHandle, sysTable);
+    if (EFI_ERROR(LibArenaCreate(&loader_arena, LOADER_ARENA_MEMORY_TYPE, LOADER_ARENA_PAGES * EFI_PAGE_SIZE))) {
+        LibArenaCreate(&loader_arena, EfiLoaderData, LOADER_ARENA_PAGES * EFI_PAGE_SIZE);
+    }
+    LibSetPrintBuffer(PRINT_BUFFER);
+    load_config(imageHandle, sysTable);
+    parse_load_options(imageHandle);
+    serial_init();
+    calibrate_tsc(sysTable);
+    boot_log_init(sysTable);
+    runtime_services.boot_trace = &boot_trace;
+    boot_stage("init");
     init_gop();
+    boot_stage("gop");
+    find_config_tables(sysTable);
+    setup_cpus(sysTable);
+    boot_stage("cpus");
+    alloc_kernel_stack(sysTable);
 
-    // Setup the memory map.
-    EFI_MEMORY_DESCRIPTOR* map = NULL;
-    UINTN mapSize, mapKey, descSize;
-    UINT32 descVersion;
-
-    sysTable->BootServices->GetMemoryMap(&mapSize, map, &mapKey, &descSize, &descVersion);
-    sysTable->BootServices->AllocatePool(EfiLoaderData, mapSize, (void**)&map);
-    sysTable->BootServices->GetMemoryMap(&mapSize, map, &mapKey, &descSize, &descVersion);          // Load memory map into memory.
-    
-    runtime_services.mmap.map = map;
-    runtime_services.mmap.mapSize = mapSize;
-    runtime_services.mmap.mapDescSize = descSize;
-    
+    // The memory map is fetched right before ExitBootServices, see exit_boot_services().
     runtime_services.canvas.x = 0;
     runtime_services.canvas.y = 0;
 
     // Load font.
-    load_font(NULL, PSF1_FONT_PATH, imageHandle, sysTable);
+    load_font(NULL, boot_options.font_path, imageHandle, sysTable);
+    boot_stage("font");
 
     if (runtime_services.psf1_font_header == NULL) {
-        Print(L"Could not load %s.\n", PSF1_FONT_PATH);
+        Print(L"Could not load %s.\n", boot_options.font_path);
         __asm__ __volatile__("cli; hlt");   
     }
 
-#if USE_WALLPAPER
-    struct BMP* wallpaper = load_wallpaper(imageHandle, sysTable);
-    runtime_services.wallpaper = wallpaper;
+    struct BMP* wallpaper = boot_options.use_wallpaper ? load_wallpaper(boot_options.wallpaper_path, imageHandle, sysTable) : NULL;
 
     if (!(wallpaper)) {
-        Print(L"Could not load wallpaper!\n");
+        if (boot_options.use_wallpaper) Print(L"Could not load wallpaper!\n");
     } else {
         // Verify that the signature is equal to 'BM'.
         if ((wallpaper->header.signature & 0xFF) == 'B' && (wallpaper->header.signature >> 8) == 'M') {
+            runtime_services.wallpaper = wallpaper;
             read_wallpaper_data(wallpaper);               // Dump data if verbose mode is on.
             display_wallpaper();
             // Setup runtime services.
             runtime_services.display_wallpaper = display_wallpaper;
+            runtime_services.refresh_wallpaper = refresh_wallpaper;
             runtime_services.display_terminal = display_terminal;
 
             // Display some things.
             display_terminal(250, 50);                                   // Display boot menu.
         }
     }
-#else
-    runtime_services.display_wallpaper = NULL;
-    runtime_services.display_terminal = NULL;
-#endif 
 
+    boot_stage("wallpaper");
 
-    runtime_services.framebuffer_write = lfb_write;
-    runtime_services.refresh_wallpaper = refresh_wallpaper;
+    runtime_services.framebuffer_write = framebuffer_write;
     runtime_services.term_write = term_write;
     runtime_services.get_mmap_entries = get_mmap_entries;
     runtime_services.index_mmap = mmap_iterator_helper;
-    term_write("\n\t\t\tBoot [X]\n\n\t\t\tReboot []", 0x7DF9FF);
+    runtime_services.reset_system = reset_system;
 
-    uint8_t menuEntry = 0;      // BOOT: 0, REBOOT: 1
-    uint8_t loop = 1;
+    uint32_t menuEntry = boot_options.default_entry;     // Entries, then reset_items.
+    uint8_t loop = boot_options.timeout != 0;
+    uint64_t timeout = boot_options.timeout > 0 ? boot_options.timeout * 10000000ULL : 0;     // 100ns units, 0 waits forever.
     EFI_INPUT_KEY Key;
 
+    // One-off command line edit.
+    char edit[CONFIG_STR_LEN];
+    size_t edit_len = 0;
+    uint8_t editing = 0;
+
+    if (loop) draw_menu(menuEntry, NULL, 0);
+
     while (loop) {
-        ST->ConIn->ReadKeyStroke(ST->ConIn, &Key);
+        // Sleep until a key arrives (or the timeout expires) instead of spinning on ReadKeyStroke.
+        if (WaitForSingleEvent(ST->ConIn->WaitForKey, timeout) == EFI_TIMEOUT) {
+            break;
+        }
 
-        // Down arrow.
-        if (Key.ScanCode == 2 && menuEntry == 0) {
-            refresh_wallpaper();
-            display_terminal(250, 50);
-            term_write("\n\t\t\tBoot []\n\n\t\t\tReboot [X]", 0x7DF9FF);
-            menuEntry = 1;
-        } else if (Key.ScanCode == 1 && menuEntry == 1) {
-            // Up arrow.
-            refresh_wallpaper();
-            display_terminal(250, 50);
-            term_write("\n\t\t\tBoot [X]\n\n\t\t\tReboot []", 0x7DF9FF);
-            menuEntry = 0;
-        } else if (Key.ScanCode == 3) {
-            // Right arrow.
-            switch (menuEntry) {
-                case 1:
-                     __asm__ __volatile__("out %%al, %%dx" : :"a" (0xFE), "d" (0x64));
-                    break;
-                case 0:
-                    // Boot.
-                    refresh_wallpaper();
-                    display_terminal(250, 50);
-                    loop = 0;
-                    break;
+        if (EFI_ERROR(uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &Key))) {
+            continue;
+        }
+
+        timeout = 0;        // Any key stops the countdown.
+
+        if (editing) {
+            if (Key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+                config_copy(boot_options.entries[menuEntry].cmdline, edit, CONFIG_STR_LEN);
+                editing = 0;
+            } else if (Key.ScanCode == SCAN_ESC) {
+                editing = 0;
+            } else if (Key.UnicodeChar == CHAR_BACKSPACE) {
+                if (edit_len) edit[--edit_len] = '\0';
+            } else if (Key.UnicodeChar >= ' ' && Key.UnicodeChar < 0x7F && edit_len < CONFIG_STR_LEN - 1) {
+                edit[edit_len++] = (char)Key.UnicodeChar;
+                edit[edit_len] = '\0';
+            } else {
+                continue;
             }
+
+            draw_menu(menuEntry, editing ? edit : NULL, 1);
+        } else if (Key.ScanCode == SCAN_DOWN && menuEntry + 1 < boot_options.n_entries + N_RESET_ITEMS) {
+            ++menuEntry;
+            draw_menu(menuEntry, NULL, 1);
+        } else if (Key.ScanCode == SCAN_UP && menuEntry > 0) {
+            --menuEntry;
+            draw_menu(menuEntry, NULL, 1);
+        } else if (Key.ScanCode == SCAN_RIGHT || Key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+            loop = 0;
+        } else if (Key.UnicodeChar == L'e' && menuEntry < boot_options.n_entries) {
+            config_copy(edit, boot_options.entries[menuEntry].cmdline, CONFIG_STR_LEN);
+            edit_len = strlen(edit);
+            editing = 1;
+            draw_menu(menuEntry, edit, 1);
+        }
+    }
+
+    if (menuEntry >= boot_options.n_entries) {
+        reset_system(reset_items[menuEntry - boot_options.n_entries].type);
+    }
+
+    boot_stage("menu");
+
+    struct BootEntry* entry = &boot_options.entries[menuEntry];
+    runtime_services.cmdline = entry->cmdline;
+
+    if (entry->video_width && entry->video_height) {
+        set_video_mode(entry->video_width, entry->video_height);
+        if (runtime_services.wallpaper && !boot_options.quiet) {
+            display_wallpaper();
+            display_terminal(250, 50);
         }
+    } else {
+        redraw_terminal();
     }
 
+    load_modules(entry, imageHandle, sysTable);
 
     // Load the kernel!
-    EFI_FILE* kernel = load_file(NULL, L"kernel.elf", imageHandle, sysTable);
-    term_write("kernel.elf has been opened.\n", 0xFFEA00);
+    UINTN kernel_size;
+    uint8_t* kernel = read_kernel(entry, &kernel_size, imageHandle, sysTable);
 
     if (!(kernel)) {
-        refresh_wallpaper();
-        display_terminal(250, 50);
-        term_write("Failed to load kernel.", 0xFF0000);
+        redraw_terminal();
+        loader_write("Failed to load kernel.", 0xFF0000);
         __asm__ __volatile__("cli; hlt");
     }
 
     Elf64_Ehdr header;
-    UINTN file_info_sz;
-    kernel->GetInfo(kernel, &gEfiFileInfoGuid, &file_info_sz, NULL);
-    UINTN size = sizeof(header);
-    kernel->Read(kernel, &size, &header);
-    term_write("Kernel read into memory.\n", 0xFFEA00);
+    loader_write("Kernel read into memory.\n", 0xFFEA00);
+
+    loader_write("Checking if ELF header is valid..\n", 0xFFEA00);
+    if (kernel_size < sizeof(header)) {
+        loader_halt("Kernel is too small for an ELF header!");
+    }
+
+    CopyMem(&header, kernel, sizeof(header));
 
-    term_write("Checking if ELF header is valid..\n", 0xFFEA00);
+    // Bounds are checked as subtractions so crafted offsets cannot wrap around.
     if (memcmp(&header.e_ident[EI_MAG0], ELFMAG, SELFMAG) != 0 || 
             header.e_ident[EI_CLASS] != ELFCLASS64 || 
             header.e_type != ET_EXEC || 
-            header.e_machine != EM_X86_64 || header.e_version != EV_CURRENT) {
+            header.e_machine != EM_X86_64 || header.e_version != EV_CURRENT ||
+            header.e_phentsize != sizeof(Elf64_Phdr) ||
+            header.e_phoff > kernel_size ||
+            (UINT64)header.e_phnum * header.e_phentsize > kernel_size - header.e_phoff) {
 
-        refresh_wallpaper();
-        display_terminal(250, 50);
-        term_write("Kernel ELF header bad!", 0xFF0000);
-        __asm__ __volatile__("cli; hlt");
+        loader_halt("Kernel ELF header bad!");
     }
 
-    term_write("Kernel ELF header is valid!\n", 0xFFEA00);
+    loader_write("Kernel ELF header is valid!\n", 0xFFEA00);
+
+    uint8_t* program_headers = kernel + header.e_phoff;
 
-    Elf64_Phdr* program_headers;
-    kernel->SetPosition(kernel, header.e_phoff);
-    term_write("Kernel ELF position set to program header offset.\n", 0xFFEA00);
-    UINTN program_header_size = header.e_phnum * header.e_phentsize;
-    sysTable->BootServices->AllocatePool(EfiLoaderData, program_header_size, (void**)&program_headers);
-    kernel->Read(kernel, &program_header_size, program_headers);
-    term_write("Program header loaded.\n", 0xFFEA00); 
+    for (uint8_t* p = program_headers; p < program_headers + header.e_phnum * header.e_phentsize; p += header.e_phentsize) {
+        Elf64_Phdr* phdr = (Elf64_Phdr*)p;
 
-    for (Elf64_Phdr* phdr = program_headers; (char*)phdr < (char*)program_headers + header.e_phnum * header.e_phentsize; phdr = (Elf64_Phdr*)((char*)phdr + header.e_phentsize)) {
         if (phdr->p_type == PT_LOAD) {
-            int pages = (phdr->p_memsz + 0x1000 - 1) / 0x1000;
+            // A segment missing from the file means a truncated kernel, never boot it.
+            if (phdr->p_filesz > kernel_size || phdr->p_offset > kernel_size - phdr->p_filesz) {
+                loader_halt("Kernel segment runs past the end of the file!");
+            }
+
+            if (phdr->p_memsz < phdr->p_filesz) {
+                loader_halt("Kernel segment is smaller in memory than in the file!");
+            }
+
+            UINTN pages = phdr->p_memsz / 0x1000 + ((phdr->p_memsz & 0xFFF) != 0);
             Elf64_Addr segment = phdr->p_paddr;
-            sysTable->BootServices->AllocatePages(AllocateAddress, EfiLoaderData, pages, &segment);
-            kernel->SetPosition(kernel, phdr->p_offset);
-            UINTN size = phdr->p_filesz;
-            kernel->Read(kernel, &size, (void*)segment);
+            if (EFI_ERROR(uefi_call_wrapper(sysTable->BootServices->AllocatePages, 4, AllocateAddress, EfiLoaderData, pages, &segment))) {
+                loader_halt("Kernel segment address is not free memory!");
+            }
+
+            CopyMem((void*)segment, kernel + phdr->p_offset, phdr->p_filesz);
+            ZeroMem((void*)(segment + phdr->p_filesz), phdr->p_memsz - phdr->p_filesz);
         }
     }
 
+    loader_write("Kernel segments loaded.\n", 0xFFEA00);
+
+
+    boot_stage("kernel_load");
+    save_boot_history(menuEntry);
 
-    void(*kernel_entry)(struct RuntimeDataAndServices) = ((__attribute__((sysv_abi))void(*)(struct RuntimeDataAndServices))header.e_entry);
+    if (boot_options.verbose) {
+        print_boot_trace();
+    }
+
+    kernel_entry = ((__attribute__((sysv_abi))void(*)(struct RuntimeDataAndServices))header.e_entry);
     boot_mode = 0;
-    sysTable->BootServices->ExitBootServices(imageHandle, mapKey);
-    kernel_entry(runtime_services);
+    runtime_services.efi_runtime.efi_call = efi_call5;
+
+    LibFlushPrint();
+    boot_log_detach(sysTable);
+
+    if (EFI_ERROR(exit_boot_services(imageHandle, sysTable))) {
+        loader_write("ExitBootServices failed.\n", 0xFF0000);
+        while (1) {
+            __asm__ __volatile__("cli; hlt");
+        }
+    }
+
+    boot_stage("exit_boot_services");
+    serial_flush();
+    jump_to_kernel();
 
     return EFI_SUCCESS;
 }
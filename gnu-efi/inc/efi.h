@@ -57,5 +57,6 @@ Revision History
 #include "efiudp.h"
 #include "efitcp.h"
 #include "efipoint.h"
+#include "efimp.h"
 
 #endif
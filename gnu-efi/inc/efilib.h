@@ -112,6 +112,8 @@ extern EFI_GUID gEfiBusSpecificDriverOverrideProtocolGuid;
 extern EFI_GUID gEfiDriverFamilyOverrideProtocolGuid;
 #define DriverFamilyOverrideProtocol gEfiDriverFamilyOverrideProtocolGuid
 extern EFI_GUID gEfiEbcProtocolGuid;
+extern EFI_GUID gEfiMpServicesProtocolGuid;
+#define MpServicesProtocol gEfiMpServicesProtocolGuid
 
 extern EFI_GUID gEfiGlobalVariableGuid;
 #define EfiGlobalVariable gEfiGlobalVariableGuid
@@ -136,6 +138,7 @@ extern EFI_GUID EfiPartTypeLegacyMbrGuid;
 
 extern EFI_GUID MpsTableGuid;
 extern EFI_GUID AcpiTableGuid;
+extern EFI_GUID Acpi20TableGuid;
 extern EFI_GUID SMBIOSTableGuid;
 extern EFI_GUID SMBIOS3TableGuid;
 extern EFI_GUID SalSystemTableGuid;
@@ -199,6 +202,11 @@ InitializeLib (
     IN EFI_SYSTEM_TABLE     *SystemTable
     );
 
+VOID
+UninitializeLib (
+    VOID
+    );
+
 VOID
 InitializeUnicodeSupport (
     CHAR8 *LangCode
@@ -478,6 +486,55 @@ FreePool (
     IN VOID     *p
     );
 
+typedef struct {
+    EFI_PHYSICAL_ADDRESS    Base;
+    UINTN                   Size;
+    UINTN                   Used;
+    EFI_MEMORY_TYPE         MemoryType;
+} MEMORY_ARENA;
+
+EFI_STATUS
+LibArenaCreate (
+    OUT MEMORY_ARENA        *Arena,
+    IN EFI_MEMORY_TYPE      MemoryType,
+    IN UINTN                Size
+    );
+
+VOID *
+LibArenaAllocate (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Size,
+    IN UINTN                Alignment
+    );
+
+VOID *
+LibArenaAllocateZero (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Size,
+    IN UINTN                Alignment
+    );
+
+UINTN
+LibArenaMark (
+    IN MEMORY_ARENA         *Arena
+    );
+
+VOID
+LibArenaReset (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Mark
+    );
+
+VOID
+LibArenaTrim (
+    IN OUT MEMORY_ARENA     *Arena
+    );
+
+VOID
+LibArenaFree (
+    IN OUT MEMORY_ARENA     *Arena
+    );
+
 
 VOID
 Output (
@@ -553,6 +610,12 @@ CatPrint (
     ...
     );
 
+CHAR16 *
+CatPrintReserve (
+    IN OUT POOL_PRINT   *Str,
+    IN UINTN            Capacity
+    );
+
 UINTN
 PrintAt (
     IN UINTN         Column,
@@ -583,6 +646,22 @@ APrint (
     ...
     );
 
+VOID
+LibSetPrintBuffer (
+    IN UINTN    Size
+    );
+
+VOID
+LibFlushPrint (
+    VOID
+    );
+
+VOID
+LibPrintStats (
+    OUT UINTN   *OutputCalls OPTIONAL,
+    OUT UINTN   *SavedCalls OPTIONAL
+    );
+
 VOID
 ValueToHex (
     IN CHAR16   *Buffer,
@@ -699,6 +778,16 @@ LibLocateHandle (
     OUT EFI_HANDLE              **Buffer
     );
 
+VOID
+LibEnableHandleCache (
+    IN BOOLEAN                  Enable
+    );
+
+VOID
+LibInvalidateHandleCache (
+    IN EFI_GUID                 *Protocol
+    );
+
 EFI_STATUS
 LibLocateHandleByDiskSignature (
     IN UINT8                        MBRType,
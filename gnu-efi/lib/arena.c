@@ -0,0 +1,227 @@
+/*++
+
+Module Name:
+
+    arena.c
+
+Abstract:
+
+    Bump allocator over a single AllocatePages region.  Lets an image
+    make many small allocations with one firmware call, without changing
+    the memory map (and its MapKey) for each of them, and hand the whole
+    region on as one block of a chosen memory type.
+
+
+
+Revision History
+
+--*/
+
+#include "lib.h"
+
+#define ARENA_DEFAULT_ALIGN     8
+
+
+EFI_STATUS
+LibArenaCreate (
+    OUT MEMORY_ARENA        *Arena,
+    IN EFI_MEMORY_TYPE      MemoryType,
+    IN UINTN                Size
+    )
+/*++
+
+Routine Description:
+
+    Allocates the pages backing an arena.
+
+Arguments:
+
+    Arena       - The arena to initialize
+
+    MemoryType  - Memory type of the pages, also what the region shows
+                  up as in the memory map
+
+    Size        - Size of the arena in bytes, rounded up to whole pages
+
+Returns:
+
+    Status of AllocatePages.  On failure the arena is empty and every
+    allocation from it returns NULL.
+
+--*/
+{
+    EFI_STATUS              Status;
+    EFI_PHYSICAL_ADDRESS    Base;
+    UINTN                   Pages;
+
+    ZeroMem (Arena, sizeof(MEMORY_ARENA));
+    Arena->MemoryType = MemoryType;
+
+    Pages = EFI_SIZE_TO_PAGES(Size);
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, MemoryType, Pages, &Base);
+    if (EFI_ERROR(Status)) {
+        DEBUG((D_ERROR, "LibArenaCreate: out of pages  %x\n", Status));
+        return Status;
+    }
+
+    Arena->Base = Base;
+    Arena->Size = Pages * EFI_PAGE_SIZE;
+    return EFI_SUCCESS;
+}
+
+
+VOID *
+LibArenaAllocate (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Size,
+    IN UINTN                Alignment
+    )
+/*++
+
+Routine Description:
+
+    Carves Size bytes off the arena.  No firmware call is made.
+
+Arguments:
+
+    Arena       - The arena to allocate from
+
+    Size        - Number of bytes
+
+    Alignment   - Power of two alignment of the result, 0 for the
+                  8 byte alignment AllocatePool gives
+
+Returns:
+
+    Pointer to the memory, or NULL if the arena does not have room
+
+--*/
+{
+    UINTN                   Offset;
+
+    if (!Alignment) {
+        Alignment = ARENA_DEFAULT_ALIGN;
+    }
+
+    Offset = (Arena->Base + Arena->Used + Alignment - 1) & ~(Alignment - 1);
+    Offset -= Arena->Base;
+
+    if (Offset > Arena->Size || Size > Arena->Size - Offset) {
+        return NULL;
+    }
+
+    Arena->Used = Offset + Size;
+    return (VOID *) (UINTN) (Arena->Base + Offset);
+}
+
+
+VOID *
+LibArenaAllocateZero (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Size,
+    IN UINTN                Alignment
+    )
+{
+    VOID                    *p;
+
+    p = LibArenaAllocate (Arena, Size, Alignment);
+    if (p) {
+        ZeroMem (p, Size);
+    }
+
+    return p;
+}
+
+
+UINTN
+LibArenaMark (
+    IN MEMORY_ARENA         *Arena
+    )
+/*++
+
+Routine Description:
+
+    Returns the current fill level of the arena, to be passed to
+    LibArenaReset to drop everything allocated after this point.
+
+--*/
+{
+    return Arena->Used;
+}
+
+
+VOID
+LibArenaReset (
+    IN OUT MEMORY_ARENA     *Arena,
+    IN UINTN                Mark
+    )
+/*++
+
+Routine Description:
+
+    Releases every allocation made since LibArenaMark returned Mark.
+    A Mark of 0 empties the arena.
+
+--*/
+{
+    if (Mark < Arena->Used) {
+        Arena->Used = Mark;
+    }
+}
+
+
+VOID
+LibArenaTrim (
+    IN OUT MEMORY_ARENA     *Arena
+    )
+/*++
+
+Routine Description:
+
+    Gives the unused whole pages at the end of the arena back to the
+    firmware, leaving only what has been handed out.  Further
+    allocations fail once the trimmed arena is full.
+
+--*/
+{
+    UINTN                   Pages;
+    UINTN                   Unused;
+
+    Pages = EFI_SIZE_TO_PAGES(Arena->Used);
+    Unused = Arena->Size / EFI_PAGE_SIZE - Pages;
+    if (!Unused) {
+        return;
+    }
+
+    if (!Pages) {
+        LibArenaFree (Arena);
+        return;
+    }
+
+    if (!EFI_ERROR(uefi_call_wrapper(BS->FreePages, 2, Arena->Base + Pages * EFI_PAGE_SIZE, Unused))) {
+        Arena->Size = Pages * EFI_PAGE_SIZE;
+    }
+}
+
+
+VOID
+LibArenaFree (
+    IN OUT MEMORY_ARENA     *Arena
+    )
+/*++
+
+Routine Description:
+
+    Returns the arena's pages to the firmware.  Every pointer handed
+    out by the arena becomes invalid.
+
+--*/
+{
+    if (Arena->Size) {
+        uefi_call_wrapper(BS->FreePages, 2, Arena->Base, Arena->Size / EFI_PAGE_SIZE);
+    }
+
+    Arena->Base = 0;
+    Arena->Size = 0;
+    Arena->Used = 0;
+}
@@ -198,21 +198,188 @@ Returns:
 }
 
 
+//
+// Slice-by-8: CrcSliceTable[k - 1][i] is the CRC of byte i followed by
+// k zero bytes, so 8 input bytes are folded with 8 independent lookups.
+// CRCTable is slice 0. Built on first use.
+//
+
+#define CRC_SLICES  8
+
+STATIC UINT32   CrcSliceTable[CRC_SLICES - 1][256];
+STATIC BOOLEAN  CrcSliceTableReady;
+
+STATIC
+VOID
+InitializeCrcSliceTable (
+    VOID
+    )
+{
+    UINTN       Index, Slice;
+    UINT32      Crc;
+
+    for (Index = 0; Index < 256; Index++) {
+        Crc = CRCTable[Index];
+        for (Slice = 0; Slice < CRC_SLICES - 1; Slice++) {
+            Crc = (Crc >> 8) ^ CRCTable[(UINT8) Crc];
+            CrcSliceTable[Slice][Index] = Crc;
+        }
+    }
+
+    CrcSliceTableReady = TRUE;
+}
+
+//
+// Updates the raw (not inverted) CRC register with Size bytes.
+//
+STATIC
+UINT32
+CrcSliceBy8 (
+    UINT32  Crc,
+    UINT8   *pt,
+    UINTN   Size
+    )
+{
+    UINT32  One, Two;
+
+    if (!CrcSliceTableReady) {
+        InitializeCrcSliceTable ();
+    }
+
+    while (Size && ((UINTN) pt & 3)) {
+        Crc = (Crc >> 8) ^ CRCTable[(UINT8) Crc ^ *pt];
+        pt += 1;
+        Size -= 1;
+    }
+
+    while (Size >= 8) {
+        One = ((UINT32 *) pt)[0] ^ Crc;
+        Two = ((UINT32 *) pt)[1];
+        Crc = CrcSliceTable[6][One & 0xff] ^
+              CrcSliceTable[5][(One >> 8) & 0xff] ^
+              CrcSliceTable[4][(One >> 16) & 0xff] ^
+              CrcSliceTable[3][One >> 24] ^
+              CrcSliceTable[2][Two & 0xff] ^
+              CrcSliceTable[1][(Two >> 8) & 0xff] ^
+              CrcSliceTable[0][(Two >> 16) & 0xff] ^
+              CRCTable[Two >> 24];
+        pt += 8;
+        Size -= 8;
+    }
+
+    while (Size) {
+        Crc = (Crc >> 8) ^ CRCTable[(UINT8) Crc ^ *pt];
+        pt += 1;
+        Size -= 1;
+    }
+
+    return Crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+//
+// Carry-less multiply folding (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction"), constants for the reflected
+// CRC32 polynomial. Four 128-bit lanes are folded 64 bytes at a time,
+// reduced to one lane, then to 32 bits with a Barrett reduction.
+//
+
+typedef long long CRC_V2DI __attribute__((__vector_size__(16), __aligned__(1), __may_alias__));
+
+#define CRC_K1K2    { 0x0154442bd4, 0x01c6e41596 }
+#define CRC_K3K4    { 0x01751997d0, 0x00ccaa009e }
+#define CRC_K5K0    { 0x0163cd6124, 0x0000000000 }
+#define CRC_POLY    { 0x01db710641, 0x01f7011641 }
+
+#define CRC_CLMUL(a, b, imm)    __builtin_ia32_pclmulqdq128 ((a), (b), (imm))
+#define CRC_FOLD(x, k, y)       (CRC_CLMUL ((x), (k), 0x00) ^ CRC_CLMUL ((x), (k), 0x11) ^ (y))
+
+//
+// Size must be at least 64 and a multiple of 16. Raw CRC register in and out.
+//
+STATIC
+__attribute__((__target__("pclmul,sse2")))
+UINT32
+CrcFoldPclmul (
+    UINT32  Crc,
+    UINT8   *pt,
+    UINTN   Size
+    )
+{
+    CONST CRC_V2DI  *p = (CONST CRC_V2DI *) pt;
+    CRC_V2DI        x0, x1, x2, x3, x4;
+    CRC_V2DI        Mask = { 0xffffffff, 0xffffffff };
+    CRC_V2DI        K1K2 = CRC_K1K2, K3K4 = CRC_K3K4, K5K0 = CRC_K5K0, Poly = CRC_POLY;
+    CRC_V2DI        CrcLane = { Crc, 0 };
+
+    x1 = p[0] ^ CrcLane;
+    x2 = p[1];
+    x3 = p[2];
+    x4 = p[3];
+    p += 4;
+    Size -= 64;
+
+    while (Size >= 64) {
+        x1 = CRC_FOLD (x1, K1K2, p[0]);
+        x2 = CRC_FOLD (x2, K1K2, p[1]);
+        x3 = CRC_FOLD (x3, K1K2, p[2]);
+        x4 = CRC_FOLD (x4, K1K2, p[3]);
+        p += 4;
+        Size -= 64;
+    }
+
+    x1 = CRC_FOLD (x1, K3K4, x2);
+    x1 = CRC_FOLD (x1, K3K4, x3);
+    x1 = CRC_FOLD (x1, K3K4, x4);
+
+    while (Size >= 16) {
+        x1 = CRC_FOLD (x1, K3K4, p[0]);
+        p += 1;
+        Size -= 16;
+    }
+
+    //
+    // 128 -> 64 bits.
+    //
+    x2 = CRC_CLMUL (x1, K3K4, 0x10);
+    x1 = (CRC_V2DI) { x1[1], 0 } ^ x2;
+    x2 = (CRC_V2DI) { (long long) (((unsigned long long) x1[0] >> 32) | ((unsigned long long) x1[1] << 32)),
+                      (long long) ((unsigned long long) x1[1] >> 32) };
+    x1 = CRC_CLMUL (x1 & Mask, K5K0, 0x00) ^ x2;
+
+    //
+    // Barrett reduction to 32 bits.
+    //
+    x0 = CRC_CLMUL (x1 & Mask, Poly, 0x10) & Mask;
+    x0 = CRC_CLMUL (x0, Poly, 0x00);
+    x1 ^= x0;
+
+    return (UINT32) ((unsigned long long) x1[0] >> 32);
+}
+
+#endif
+
 UINT32
 CalculateCrc (
     UINT8 *pt,
     UINTN Size
     )
 {
-    UINTN Crc;
+    UINT32 Crc;
 
     // compute crc
     Crc = 0xffffffff;
-    while (Size) {
-        Crc = (Crc >> 8) ^ CRCTable[(UINT8) Crc ^ *pt];
-        pt += 1;
-        Size -= 1;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (LibHasPclmul && Size >= 64) {
+        Crc = CrcFoldPclmul (Crc, pt, Size & ~(UINTN) 15);
+        pt += Size & ~(UINTN) 15;
+        Size &= 15;
     }
+#endif
+
+    Crc = CrcSliceBy8 (Crc, pt, Size);
     Crc = Crc ^ 0xffffffff;
-    return (UINT32)Crc;
+    return Crc;
 }
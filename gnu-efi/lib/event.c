@@ -148,6 +148,10 @@ WaitForEventWithTimeout (
                 return;
             }
         }
+
+        if (Timeout) {
+            Timeout--;
+        }
     } while (Timeout > 0);
     CopyMem(Key, &TimeoutKey, sizeof(EFI_INPUT_KEY));
 }
@@ -7,6 +7,8 @@ Exit(
     IN CHAR16       *ExitData OPTIONAL
     )
 {
+    UninitializeLib ();
+
     uefi_call_wrapper(BS->Exit,
             4,
             LibImageHandle,
@@ -100,6 +100,42 @@ static struct {
 	{  NULL, L"" }
 };
 
+//
+// Open addressed hash over KnownGuids keyed on the first 64 bits of the
+// GUID (Data1..Data3), built by InitializeGuid. Slots hold an index into
+// KnownGuids, GUID_HASH_EMPTY marks a free slot.
+//
+
+#define GUID_HASH_BITS      7
+#define GUID_HASH_SIZE      (1 << GUID_HASH_BITS)
+#define GUID_HASH_EMPTY     0xFF
+
+//
+// Slots are UINT8 indexes, so every index must stay below GUID_HASH_EMPTY.
+// Keeping the table at most half full keeps probe chains short and
+// guarantees InitializeGuid finds a free slot for every entry.
+//
+
+#define KNOWN_GUID_COUNT    (sizeof(KnownGuids) / sizeof(KnownGuids[0]) - 1)
+
+_Static_assert (KNOWN_GUID_COUNT <= GUID_HASH_SIZE / 2, "KnownGuids too large for GuidHash");
+_Static_assert (GUID_HASH_SIZE <= GUID_HASH_EMPTY, "GuidHash slots cannot index KnownGuids");
+
+static UINT8    GuidHash[GUID_HASH_SIZE];
+static BOOLEAN  GuidHashReady;
+
+static
+UINTN
+GuidHashSlot (
+    IN EFI_GUID     *Guid
+    )
+{
+    UINT64          Key;
+
+    Key = Guid->Data1 | ((UINT64) Guid->Data2 << 32) | ((UINT64) Guid->Data3 << 48);
+    return (UINTN) ((Key * 0x9E3779B97F4A7C15ULL) >> (64 - GUID_HASH_BITS));
+}
+
 //
 //
 //
@@ -112,6 +148,20 @@ InitializeGuid (
     VOID
     )
 {
+    UINTN           Index, Slot;
+
+    SetMem (GuidHash, sizeof(GuidHash), GUID_HASH_EMPTY);
+
+    for (Index=0; KnownGuids[Index].Guid; Index++) {
+        Slot = GuidHashSlot (KnownGuids[Index].Guid);
+        while (GuidHash[Slot] != GUID_HASH_EMPTY) {
+            Slot = (Slot + 1) & (GUID_HASH_SIZE - 1);
+        }
+
+        GuidHash[Slot] = (UINT8) Index;
+    }
+
+    GuidHashReady = TRUE;
 }
 
 INTN
@@ -146,13 +196,18 @@ GuidToString (
     )
 {
 
-    UINTN           Index;
+    UINTN           Index, Slot;
 
     //
     // Else, (for now) use additional internal function for mapping guids
     //
 
-    for (Index=0; KnownGuids[Index].Guid; Index++) {
+    if (!GuidHashReady) {
+        InitializeGuid ();
+    }
+
+    for (Slot = GuidHashSlot (Guid); GuidHash[Slot] != GUID_HASH_EMPTY; Slot = (Slot + 1) & (GUID_HASH_SIZE - 1)) {
+        Index = GuidHash[Slot];
         if (CompareGuid(Guid, KnownGuids[Index].Guid) == 0) {
             SPrint (Buffer, 0, KnownGuids[Index].GuidName);
             return ;
@@ -18,6 +18,45 @@ Revision History
 #include "lib.h"
 #include "efistdarg.h"                        // !!!
 
+//
+// Optional cache of ByProtocol handle buffers, see LibEnableHandleCache.
+// Each cached protocol has a protocol notify event that marks its entry
+// stale when a handle with the protocol is installed.
+//
+
+#define HANDLE_CACHE_SIZE       16          // power of two
+#define HANDLE_CACHE_INDEX(g)   (((g)->Data1 * 0x9E3779B1U) >> 28)
+
+typedef struct {
+    BOOLEAN             InUse;
+    volatile BOOLEAN    Valid;
+    EFI_GUID            Protocol;
+    EFI_EVENT           Event;
+    VOID                *Registration;
+    EFI_STATUS          Status;
+    UINTN               NoHandles;
+    EFI_HANDLE          *Handles;
+} HANDLE_CACHE_ENTRY;
+
+STATIC HANDLE_CACHE_ENTRY   HandleCache[HANDLE_CACHE_SIZE];
+STATIC BOOLEAN              HandleCacheEnabled;
+
+STATIC
+HANDLE_CACHE_ENTRY *
+HandleCacheLookup (
+    IN EFI_GUID         *Protocol
+    );
+
+STATIC
+EFI_STATUS
+LocateHandleWorker (
+    IN EFI_LOCATE_SEARCH_TYPE       SearchType,
+    IN EFI_GUID                     *Protocol OPTIONAL,
+    IN VOID                         *SearchKey OPTIONAL,
+    IN OUT UINTN                    *NoHandles,
+    OUT EFI_HANDLE                  **Buffer
+    );
+
 
 EFI_STATUS
 LibLocateProtocol (
@@ -28,12 +67,32 @@ LibLocateProtocol (
 // Find the first instance of this Protocol in the system and return it's interface
 //
 {
-    EFI_STATUS      Status;
-    UINTN           NumberHandles, Index;
-    EFI_HANDLE      *Handles;
+    EFI_STATUS          Status;
+    UINTN               NumberHandles, Index;
+    EFI_HANDLE          *Handles;
+    HANDLE_CACHE_ENTRY  *Entry;
 
     
     *Interface = NULL;
+
+    //
+    // A cached handle buffer can be used as is.  If none of its handles
+    // has the protocol any more it is out of date: drop the entry and
+    // let the lookup below fetch the handles again.
+    //
+
+    Entry = HandleCacheEnabled ? HandleCacheLookup (ProtocolGuid) : NULL;
+    if (Entry && !EFI_ERROR(Entry->Status)) {
+        for (Index=0; Index < Entry->NoHandles; Index++) {
+            Status = uefi_call_wrapper(BS->HandleProtocol, 3, Entry->Handles[Index], ProtocolGuid, Interface);
+            if (!EFI_ERROR(Status)) {
+                return Status;
+            }
+        }
+
+        Entry->Valid = FALSE;
+    }
+
     Status = LibLocateHandle (ByProtocol, ProtocolGuid, NULL, &NumberHandles, &Handles);
     if (EFI_ERROR(Status)) {
         DEBUG((D_INFO, "LibLocateProtocol: Handle not found\n"));
@@ -63,6 +122,46 @@ LibLocateHandle (
     OUT EFI_HANDLE                  **Buffer
     )
 
+{
+    HANDLE_CACHE_ENTRY  *Entry;
+
+    //
+    // ByProtocol lookups are answered from the handle cache when it is
+    // enabled, the caller still gets its own copy to free
+    //
+
+    if (HandleCacheEnabled && SearchType == ByProtocol && Protocol) {
+        Entry = HandleCacheLookup (Protocol);
+        if (Entry) {
+            *NoHandles = 0;
+            *Buffer = NULL;
+            if (EFI_ERROR(Entry->Status)) {
+                return Entry->Status;
+            }
+
+            *Buffer = AllocatePool (Entry->NoHandles * sizeof(EFI_HANDLE));
+            if (*Buffer) {
+                CopyMem (*Buffer, Entry->Handles, Entry->NoHandles * sizeof(EFI_HANDLE));
+                *NoHandles = Entry->NoHandles;
+                return EFI_SUCCESS;
+            }
+        }
+    }
+
+    return LocateHandleWorker (SearchType, Protocol, SearchKey, NoHandles, Buffer);
+}
+
+
+STATIC
+EFI_STATUS
+LocateHandleWorker (
+    IN EFI_LOCATE_SEARCH_TYPE       SearchType,
+    IN EFI_GUID                     *Protocol OPTIONAL,
+    IN VOID                         *SearchKey OPTIONAL,
+    IN OUT UINTN                    *NoHandles,
+    OUT EFI_HANDLE                  **Buffer
+    )
+// LocateHandle with a growing buffer
 {
     EFI_STATUS          Status;
     UINTN               BufferSize;
@@ -101,6 +200,178 @@ LibLocateHandle (
     return Status;
 }
 
+
+STATIC
+VOID
+EFIAPI
+HandleCacheNotify (
+    IN EFI_EVENT        Event EFI_UNUSED,
+    IN VOID             *Context
+    )
+// A handle with the entry's protocol was installed
+{
+    ((HANDLE_CACHE_ENTRY *) Context)->Valid = FALSE;
+}
+
+
+STATIC
+HANDLE_CACHE_ENTRY *
+HandleCacheLookup (
+    IN EFI_GUID         *Protocol
+    )
+/*++
+
+Routine Description:
+
+    Finds the cache entry for Protocol, creating it or refreshing its
+    handle buffer as needed.
+
+Returns:
+
+    The entry, or NULL if the protocol cannot be cached (cache full or
+    the notify event could not be created).
+
+--*/
+{
+    HANDLE_CACHE_ENTRY  *Entry;
+    UINTN               Index, Probe;
+
+    Index = HANDLE_CACHE_INDEX (Protocol);
+    for (Probe = 0; Probe < HANDLE_CACHE_SIZE; Probe++) {
+        Entry = &HandleCache[(Index + Probe) & (HANDLE_CACHE_SIZE - 1)];
+
+        if (!Entry->InUse) {
+            //
+            // Registering signals the event once, so the entry starts out stale
+            //
+
+            Entry->Event = LibCreateProtocolNotifyEvent (
+                                Protocol,
+                                TPL_CALLBACK,
+                                HandleCacheNotify,
+                                Entry,
+                                &Entry->Registration
+                                );
+            if (!Entry->Event) {
+                return NULL;
+            }
+
+            CopyMem (&Entry->Protocol, Protocol, sizeof(EFI_GUID));
+            Entry->InUse = TRUE;
+            Entry->Valid = FALSE;
+            break;
+        }
+
+        if (CompareGuid (&Entry->Protocol, Protocol) == 0) {
+            break;
+        }
+    }
+
+    if (Probe == HANDLE_CACHE_SIZE) {
+        return NULL;
+    }
+
+    if (!Entry->Valid) {
+        //
+        // Mark valid first, an install during the lookup below
+        // leaves the entry stale for the next call
+        //
+
+        Entry->Valid = TRUE;
+        if (Entry->Handles) {
+            FreePool (Entry->Handles);
+        }
+
+        Entry->Status = LocateHandleWorker (ByProtocol, Protocol, NULL, &Entry->NoHandles, &Entry->Handles);
+    }
+
+    return Entry;
+}
+
+
+VOID
+LibEnableHandleCache (
+    IN BOOLEAN          Enable
+    )
+/*++
+
+Routine Description:
+
+    Turns caching of LibLocateHandle (ByProtocol) and LibLocateProtocol
+    results on or off.  Once a protocol has been looked up, later
+    lookups of it cost a hash probe until a handle with the protocol is
+    installed.  Uninstalls have no notify, so a cached buffer can hold
+    handles the protocol has since been removed from.  Callers check
+    HandleProtocol's status as they would anyway and, when it fails on
+    a cached handle, call LibInvalidateHandleCache; LibLocateProtocol
+    does so itself.
+
+    Disabling frees the cache and closes its notify events, whose
+    callbacks live in the image.  UninitializeLib disables it, which
+    the x86_64 crt0 calls when efi_main returns and Exit calls before
+    exiting.
+
+Arguments:
+
+    Enable      - TRUE to cache lookups, FALSE to drop the cache
+
+--*/
+{
+    HANDLE_CACHE_ENTRY  *Entry;
+
+    if (!Enable) {
+        for (Entry = HandleCache; Entry < HandleCache + HANDLE_CACHE_SIZE; Entry++) {
+            if (!Entry->InUse) {
+                continue;
+            }
+
+            uefi_call_wrapper(BS->CloseEvent, 1, Entry->Event);
+            if (Entry->Handles) {
+                FreePool (Entry->Handles);
+            }
+        }
+
+        ZeroMem (HandleCache, sizeof(HandleCache));
+    }
+
+    HandleCacheEnabled = Enable;
+}
+
+VOID
+LibInvalidateHandleCache (
+    IN EFI_GUID         *Protocol
+    )
+/*++
+
+Routine Description:
+
+    Drops the cached handles of Protocol, the next lookup fetches them
+    from the firmware again.  For callers that found a handle returned
+    by LibLocateHandle no longer has the protocol.
+
+Arguments:
+
+    Protocol    - The protocol whose handles are out of date
+
+--*/
+{
+    HANDLE_CACHE_ENTRY  *Entry;
+    UINTN               Index, Probe;
+
+    Index = HANDLE_CACHE_INDEX (Protocol);
+    for (Probe = 0; Probe < HANDLE_CACHE_SIZE; Probe++) {
+        Entry = &HandleCache[(Index + Probe) & (HANDLE_CACHE_SIZE - 1)];
+        if (!Entry->InUse) {
+            return;
+        }
+
+        if (CompareGuid (&Entry->Protocol, Protocol) == 0) {
+            Entry->Valid = FALSE;
+            return;
+        }
+    }
+}
+
 EFI_STATUS
 LibLocateHandleByDiskSignature (
     IN UINT8                        MBRType,
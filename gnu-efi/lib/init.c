@@ -106,6 +106,27 @@ Returns:
     }
 }
 
+VOID
+UninitializeLib (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Releases what the library set up that would outlive the image's
+    code: the handle cache's protocol notify events, whose callbacks
+    live in the image.  The x86_64 crt0 calls this when efi_main
+    returns and Exit calls it before exiting, so an image only needs
+    to call it itself when it leaves some other way.  A driver that
+    stays resident loses its handle cache, not its lookups.
+
+--*/
+{
+    LibEnableHandleCache (FALSE);
+}
+
+
 VOID
 InitializeUnicodeSupport (
     CHAR8 *LangCode
@@ -192,6 +213,109 @@ EFIDebugVariable (
 #define __SIZE_TYPE__ UINTN
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+
+//
+// Sizes up to 16 bytes are done with two possibly overlapping loads and
+// stores, up to MEM_REP_THRESHOLD with an 8-byte word loop, and above it
+// with rep movsb/stosb when InitializePlatform found ERMS, otherwise with
+// rep movsq/stosq. Before InitializeLib runs the non-ERMS path is used.
+//
+
+#define MEM_REP_THRESHOLD   512
+
+typedef UINT64 __attribute__((__may_alias__, __aligned__(1))) MEM_U64;
+typedef UINT32 __attribute__((__may_alias__, __aligned__(1))) MEM_U32;
+
+#if defined(__clang__)
+#define MEM_NO_LIBCALL
+#else
+#define MEM_NO_LIBCALL      __attribute__((__optimize__("no-tree-loop-distribute-patterns")))
+#endif
+
+MEM_NO_LIBCALL
+void *memset(void *s, int c, __SIZE_TYPE__ n)
+{
+    unsigned char *p = s;
+    UINT64 w = (unsigned char)c * 0x0101010101010101ULL;
+
+    if (n < 8) {
+        if (n >= 4) {
+            *(MEM_U32 *)p = (UINT32)w;
+            *(MEM_U32 *)(p + n - 4) = (UINT32)w;
+        } else {
+            while (n--)
+                *p++ = c;
+        }
+        return s;
+    }
+
+    *(MEM_U64 *)(p + n - 8) = w;
+    if (n <= 16) {
+        *(MEM_U64 *)p = w;
+        return s;
+    }
+
+    if (n >= MEM_REP_THRESHOLD) {
+        if (LibHasErms) {
+            __asm__ __volatile__ ("rep stosb" : "+D" (p), "+c" (n) : "a" (c) : "memory");
+        } else {
+            // Tail was stored above.
+            n /= 8;
+            __asm__ __volatile__ ("rep stosq" : "+D" (p), "+c" (n) : "a" (w) : "memory");
+        }
+        return s;
+    }
+
+    for (; n > 8; n -= 8, p += 8)
+        *(MEM_U64 *)p = w;
+
+    return s;
+}
+
+MEM_NO_LIBCALL
+void *memcpy(void *dest, const void *src, __SIZE_TYPE__ n)
+{
+    const unsigned char *q = src;
+    unsigned char *p = dest;
+
+    if (n < 8) {
+        if (n >= 4) {
+            UINT32 head = *(const MEM_U32 *)q, tail = *(const MEM_U32 *)(q + n - 4);
+            *(MEM_U32 *)p = head;
+            *(MEM_U32 *)(p + n - 4) = tail;
+        } else {
+            while (n--)
+                *p++ = *q++;
+        }
+        return dest;
+    }
+
+    *(MEM_U64 *)(p + n - 8) = *(const MEM_U64 *)(q + n - 8);
+    if (n <= 16) {
+        *(MEM_U64 *)p = *(const MEM_U64 *)q;
+        return dest;
+    }
+
+    if (n >= MEM_REP_THRESHOLD) {
+        if (LibHasErms) {
+            __asm__ __volatile__ ("rep movsb" : "+D" (p), "+S" (q), "+c" (n) : : "memory");
+        } else {
+            // Tail was copied above.
+            n /= 8;
+            __asm__ __volatile__ ("rep movsq" : "+D" (p), "+S" (q), "+c" (n) : : "memory");
+        }
+        return dest;
+    }
+
+    for (; n > 8; n -= 8, p += 8, q += 8)
+        *(MEM_U64 *)p = *(const MEM_U64 *)q;
+
+    return dest;
+}
+
+#else
+
 void *memset(void *s, int c, __SIZE_TYPE__ n)
 {
     unsigned char *p = s;
@@ -212,3 +336,5 @@ void *memcpy(void *dest, const void *src, __SIZE_TYPE__ n)
 
     return dest;
 }
+
+#endif
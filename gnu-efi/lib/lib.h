@@ -90,3 +90,7 @@ extern EFI_UNICODE_COLLATION_INTERFACE  *UnicodeInterface;
 extern EFI_UNICODE_COLLATION_INTERFACE  LibStubUnicodeInterface;
 extern EFI_RAISE_TPL                    LibRuntimeRaiseTPL;
 extern EFI_RESTORE_TPL                  LibRuntimeRestoreTPL;
+#if defined(__x86_64__)
+extern BOOLEAN                          LibHasErms;
+extern BOOLEAN                          LibHasPclmul;
+#endif
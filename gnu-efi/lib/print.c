@@ -51,6 +51,19 @@ Revision History
 #define PRINT_STRING_LEN            200
 #define PRINT_ITEM_BUFFER_LEN       100
 
+//
+// Console output buffer used by LibSetPrintBuffer.  Consecutive Print
+// calls are coalesced into it and handed to OutputString once per line,
+// when it fills, or on LibFlushPrint.
+//
+
+STATIC CHAR16                       *PrintBuffer;
+STATIC UINTN                        PrintBufferSize;
+STATIC UINTN                        PrintBufferPos;
+STATIC SIMPLE_TEXT_OUTPUT_INTERFACE *PrintBufferOut;
+STATIC UINTN                        PrintOutputCalls;
+STATIC UINTN                        PrintUnbufferedCalls;
+
 typedef struct {
     BOOLEAN             Ascii;
     UINTN               Index;
@@ -87,6 +100,8 @@ typedef struct _pstate {
     CHAR16      *End;
     CHAR16      *Pos;
     UINTN       Len;
+    BOOLEAN     Buffered;
+    CHAR16      *Scratch;
 
     UINTN       Attr;
     UINTN       RestoreAttr;
@@ -163,6 +178,12 @@ PSETATTR (
     IN UINTN             Attr
     );
 
+STATIC
+VOID
+PPOOLPOS (
+    IN OUT PRINT_STATE  *ps
+    );
+
 //
 //
 //
@@ -352,6 +373,43 @@ _SPrint (
 }
 
 
+STATIC
+BOOLEAN
+PoolPrintGrow (
+    IN OUT POOL_PRINT   *spc,
+    IN UINTN            Needed
+    )
+// Grows the pool buffer to at least Needed characters, doubling it
+// so that building a long string stays linear
+{
+    UINTN           newmax;
+
+    newmax = spc->maxlen * 2;
+    if (newmax < PRINT_STRING_LEN) {
+        newmax = PRINT_STRING_LEN;
+    }
+
+    if (newmax < Needed) {
+        newmax = Needed;
+    }
+
+    spc->str = ReallocatePool (
+                    spc->str,
+                    spc->str ? (spc->len + 1) * sizeof(CHAR16) : 0,
+                    newmax * sizeof(CHAR16)
+                    );
+
+    if (!spc->str) {
+        spc->len = 0;
+        spc->maxlen = 0;
+        return FALSE;
+    }
+
+    spc->maxlen = newmax;
+    return TRUE;
+}
+
+
 INTN EFIAPI
 _PoolPrint (
     IN VOID     *Context,
@@ -359,41 +417,189 @@ _PoolPrint (
     )
 // Append string worker for PoolPrint and CatPrint
 {
-    UINTN           newlen;
+    UINTN           len;
     POOL_PRINT      *spc;
 
     spc = Context;
-    newlen = spc->len + StrLen(Buffer) + 1;
 
     //
-    // Is the string is over the max, grow the buffer
+    // Text formatted straight into the pool buffer only needs
+    // to be accounted for
     //
 
-    if (newlen > spc->maxlen) {
-
-        //
-        // Grow the pool buffer
-        //
+    if (spc->str && Buffer == spc->str + spc->len) {
+        spc->len += StrLen(Buffer);
+        return 0;
+    }
 
-        newlen += PRINT_STRING_LEN;
-        spc->maxlen = newlen;
-        spc->str = ReallocatePool (
-                        spc->str,
-                        spc->len * sizeof(CHAR16),
-                        spc->maxlen * sizeof(CHAR16)
-                        );
+    //
+    // Is the string is over the max, grow the buffer
+    //
 
-        if (!spc->str) {
-            spc->len = 0;
-            spc->maxlen = 0;
+    len = StrLen(Buffer);
+    if (spc->len + len + 1 > spc->maxlen) {
+        if (!PoolPrintGrow (spc, spc->len + len + 1)) {
+            return 0;
         }
     }
 
     //
-    // Append the new text
+    // Append the new text and its terminator
     //
 
-    return _SPrint (Context, Buffer);
+    CopyMem (spc->str + spc->len, Buffer, (len + 1) * sizeof(CHAR16));
+    spc->len += len;
+    return 0;
+}
+
+
+STATIC
+BOOLEAN
+PoolPrintAliased (
+    IN CONST CHAR16     *fmt,
+    IN va_list          args,
+    IN POOL_PRINT       *spc
+    )
+// Checks whether a %s or %a argument points into the pool string.  The
+// text is formatted in place at its end and the buffer may be moved as
+// it grows, so such an argument would be overwritten or freed while it
+// is still being read.  Consumes the arguments the way _Print does.
+{
+    va_list         ap;
+    CHAR8           *p;
+    CHAR16          c;
+    BOOLEAN         Long, Done, Aliased;
+
+    if (!spc->str) {
+        return FALSE;
+    }
+
+    Aliased = FALSE;
+    va_copy (ap, args);
+    while (!Aliased && (c = *fmt++)) {
+        if (c != '%') {
+            continue;
+        }
+
+        Long = FALSE;
+        for (Done = FALSE; !Done && *fmt; ) {
+            c = *fmt++;
+            Done = TRUE;
+            p = NULL;
+
+            switch (c) {
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+            case '-': case ',': case '.':
+            case 'n': case 'h': case 'e':
+                Done = FALSE;
+                break;
+
+            case '*':
+                (VOID) va_arg(ap, UINTN);
+                Done = FALSE;
+                break;
+
+            case 'l':
+                Long = TRUE;
+                Done = FALSE;
+                break;
+
+            case 'a':
+                p = va_arg(ap, CHAR8 *);
+                break;
+
+            case 's':
+                p = (CHAR8 *) va_arg(ap, CHAR16 *);
+                break;
+
+            case 'X':
+            case 'x':
+            case 'u':
+                if (Long) {
+                    (VOID) va_arg(ap, UINT64);
+                } else {
+                    (VOID) va_arg(ap, UINT32);
+                }
+                break;
+
+            case 'd':
+                if (Long) {
+                    (VOID) va_arg(ap, INT64);
+                } else {
+                    (VOID) va_arg(ap, INT32);
+                }
+                break;
+
+            case 'c':
+                (VOID) va_arg(ap, UINTN);
+                break;
+
+            case 'g':
+            case 't':
+            case 'D':
+                (VOID) va_arg(ap, VOID *);
+                break;
+
+            case 'f':
+                (VOID) va_arg(ap, double);
+                break;
+
+            case 'r':
+                (VOID) va_arg(ap, EFI_STATUS);
+                break;
+            }
+
+            if (p && p >= (CHAR8 *) spc->str && p < (CHAR8 *) (spc->str + spc->maxlen)) {
+                Aliased = TRUE;
+            }
+        }
+    }
+
+    va_end (ap);
+    return Aliased;
+}
+
+
+CHAR16 *
+CatPrintReserve (
+    IN OUT POOL_PRINT   *Str,
+    IN UINTN            Capacity
+    )
+/*++
+
+Routine Description:
+
+    Makes sure Str has room for Capacity characters, terminator
+    included, before it is built up with CatPrint.  Callers that know
+    roughly how long the result will be avoid all intermediate
+    reallocations.
+
+Arguments:
+
+    Str         - Tracks the allocated pool, size in use, and
+                  amount of pool allocated.  A zeroed POOL_PRINT
+                  starts a new string.
+
+    Capacity    - Number of characters to reserve
+
+Returns:
+
+    The pool buffer, or NULL if it could not be allocated
+
+--*/
+{
+    if (Capacity > Str->maxlen) {
+        if (!PoolPrintGrow (Str, Capacity)) {
+            return NULL;
+        }
+
+        if (!Str->len) {
+            Str->str[0] = 0;
+        }
+    }
+
+    return Str->str;
 }
 
 
@@ -576,6 +782,10 @@ Routine Description:
     Concatenates a formatted unicode string to allocated pool.
     The caller must free the resulting buffer.
 
+    A %s or %a argument may point into Str->str itself, e.g.
+    CatPrint (Str, L"%s", Str->str).  The text is then formatted into
+    a pool of its own first and appended once it is complete.
+
 Arguments:
 
     Str         - Tracks the allocated pool, size in use, and
@@ -592,9 +802,19 @@ Returns:
 --*/
 {
     va_list             args;
+    POOL_PRINT          spc;
 
     va_start (args, fmt);
-    _PoolCatPrint (fmt, args, Str, _PoolPrint);
+    if (PoolPrintAliased (fmt, args, Str)) {
+        ZeroMem (&spc, sizeof(spc));
+        _PoolCatPrint (fmt, args, &spc, _PoolPrint);
+        if (spc.str) {
+            _PoolPrint (Str, spc.str);
+            FreePool (spc.str);
+        }
+    } else {
+        _PoolCatPrint (fmt, args, Str, _PoolPrint);
+    }
     va_end (args);
     return Str->str;
 }
@@ -799,8 +1019,20 @@ _IPrint (
 
     va_copy(ps.args, args);
 
+    //
+    // Anything still buffered must reach the screen before the cursor
+    // moves or a different console is written to
+    //
+
+    if (PrintBufferPos && (Column != (UINTN) -1 || Out != PrintBufferOut)) {
+        LibFlushPrint ();
+    }
+
     if (Column != (UINTN) -1) {
         uefi_call_wrapper(Out->SetCursorPosition, 3, Out, Column, Row);
+    } else if (PrintBuffer) {
+        PrintBufferOut = Out;
+        ps.Buffered = TRUE;
     }
 
     back = _Print (&ps);
@@ -842,17 +1074,153 @@ Returns:
 }
 
 
+VOID
+LibSetPrintBuffer (
+    IN UINTN    Size
+    )
+/*++
+
+Routine Description:
+
+    Makes Print and the other console print functions collect their
+    output in a pool buffer of Size characters instead of calling
+    OutputString at the end of every call.  The buffer is written out
+    on each newline, when it fills, before attribute changes and cursor
+    moves, and on LibFlushPrint.
+
+Arguments:
+
+    Size        - Buffer size in characters, 0 to go back to unbuffered
+                  output
+
+Returns:
+
+    None.  If the pool allocation fails output stays unbuffered.
+
+--*/
+{
+    LibFlushPrint ();
+
+    if (PrintBuffer) {
+        FreePool (PrintBuffer);
+        PrintBuffer = NULL;
+        PrintBufferSize = 0;
+    }
+
+    if (Size < PRINT_STRING_LEN) {
+        Size = Size ? PRINT_STRING_LEN : 0;
+    }
+
+    if (Size) {
+        PrintBuffer = AllocatePool (Size * sizeof(CHAR16));
+        if (PrintBuffer) {
+            PrintBufferSize = Size;
+        }
+    }
+}
+
+
+VOID
+LibFlushPrint (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes out any console output held back by LibSetPrintBuffer.
+    Call before waiting for input after a prompt that does not end
+    in a newline, and before ExitBootServices.
+
+--*/
+{
+    if (!PrintBufferPos) {
+        return;
+    }
+
+    PrintBuffer[PrintBufferPos] = 0;
+    uefi_call_wrapper(PrintBufferOut->OutputString, 2, PrintBufferOut, PrintBuffer);
+    PrintBufferPos = 0;
+    PrintOutputCalls += 1;
+}
+
+
+VOID
+LibPrintStats (
+    OUT UINTN   *OutputCalls OPTIONAL,
+    OUT UINTN   *SavedCalls OPTIONAL
+    )
+/*++
+
+Routine Description:
+
+    Reports how many OutputString calls buffered printing has made,
+    and how many more the unbuffered path would have needed for the
+    same output.
+
+Arguments:
+
+    OutputCalls - OutputString calls made from the print buffer
+    SavedCalls  - OutputString calls avoided by coalescing
+
+--*/
+{
+    if (OutputCalls) {
+        *OutputCalls = PrintOutputCalls;
+    }
+
+    if (SavedCalls) {
+        *SavedCalls = PrintUnbufferedCalls > PrintOutputCalls ?
+                      PrintUnbufferedCalls - PrintOutputCalls : 0;
+    }
+}
+
+
 STATIC
 VOID
 PFLUSH (
     IN OUT PRINT_STATE     *ps
     )
 {
+    if (ps->Buffered) {
+        if (ps->Pos == ps->Buffer) {
+            return;
+        }
+        PrintOutputCalls += 1;
+    }
+
     *ps->Pos = 0;
     if (IsLocalPrint(ps->Output))
 	ps->Output(ps->Context, ps->Buffer);
     else
     	uefi_call_wrapper(ps->Output, 2, ps->Context, ps->Buffer);
+
+    if (ps->Output == _PoolPrint) {
+        PPOOLPOS (ps);
+    } else {
+        ps->Pos = ps->Buffer;
+    }
+}
+
+STATIC
+VOID
+PPOOLPOS (
+    IN OUT PRINT_STATE  *ps
+    )
+// Points the output buffer at the free end of the pool string when there
+// is room for it, so PoolPrint and CatPrint format in place
+{
+    POOL_PRINT      *spc;
+
+    spc = ps->Context;
+    if (spc->str && spc->maxlen - spc->len > PRINT_STRING_LEN) {
+        ps->Buffer = spc->str + spc->len;
+        ps->End = spc->str + spc->maxlen - 1;
+    } else {
+        ps->Buffer = ps->Scratch;
+        ps->End = ps->Scratch + PRINT_STRING_LEN - 1;
+    }
+
     ps->Pos = ps->Buffer;
 }
 
@@ -863,6 +1231,10 @@ PSETATTR (
     IN UINTN             Attr
     )
 {
+   if (ps->Buffered) {
+        PrintUnbufferedCalls += 1;
+   }
+
    PFLUSH (ps);
 
    ps->RestoreAttr = ps->Attr;
@@ -889,8 +1261,8 @@ PPUTC (
     ps->Pos += 1;
     ps->Len += 1;
 
-    // if at the end of the buffer, flush it
-    if (ps->Pos >= ps->End) {
+    // if at the end of the buffer, or at the end of a buffered line, flush it
+    if (ps->Pos >= ps->End || (ps->Buffered && c == '\n')) {
         PFLUSH(ps);
     }
 }
@@ -1028,9 +1400,19 @@ Returns:
     CHAR16          Buffer[PRINT_STRING_LEN];
 
     ps->Len = 0;
-    ps->Buffer = Buffer;
-    ps->Pos = Buffer;
-    ps->End = Buffer + PRINT_STRING_LEN - 1;
+    if (ps->Buffered) {
+        ps->Buffer = PrintBuffer;
+        ps->Pos = PrintBuffer + PrintBufferPos;
+        ps->End = PrintBuffer + PrintBufferSize - 1;
+    } else {
+        ps->Buffer = Buffer;
+        ps->Pos = Buffer;
+        ps->End = Buffer + PRINT_STRING_LEN - 1;
+    }
+    ps->Scratch = Buffer;
+    if (ps->Output == _PoolPrint) {
+        PPOOLPOS (ps);
+    }
     ps->Item = &Item;
 
     ps->fmt.Index = 0;
@@ -1249,8 +1631,13 @@ Returns:
         }
     }
 
-    // Flush buffer
-    PFLUSH (ps);
+    // Flush buffer, or leave it for the next print if buffered
+    if (ps->Buffered) {
+        PrintBufferPos = ps->Pos - ps->Buffer;
+        PrintUnbufferedCalls += 1 + ps->Len / (PRINT_STRING_LEN - 1);
+    } else {
+        PFLUSH (ps);
+    }
     return ps->Len;
 }
 
@@ -20,6 +20,27 @@ Revision History
 #include "efilib.h"
 #include "efirtlib.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+//
+// From this size on rep movsb/stosb beats the word loops on CPUs with
+// ERMS (and is no worse on older ones with fast strings), below it the
+// string instructions' startup cost dominates.
+//
+#define RT_REP_THRESHOLD    256
+
+typedef UINT64 __attribute__((__may_alias__, __aligned__(1))) RT_UNALIGNED_UINT64;
+
+//
+// Keep GCC from turning the loops below back into memset/memcpy calls,
+// those end up here again.
+//
+#if defined(__clang__)
+#define RT_NO_LIBCALL
+#else
+#define RT_NO_LIBCALL       __attribute__((__optimize__("no-tree-loop-distribute-patterns")))
+#endif
+#endif
+
 #ifndef __GNUC__
 #pragma RUNTIME_CODE(RtZeroMem)
 #endif
@@ -30,12 +51,7 @@ RtZeroMem (
     IN UINTN     Size
     )
 {
-    INT8        *pt;
-
-    pt = Buffer;
-    while (Size--) {
-        *(pt++) = 0;
-    }
+    RtSetMem (Buffer, Size, 0);
 }
 
 #ifndef __GNUC__
@@ -43,15 +59,47 @@ RtZeroMem (
 #endif
 VOID
 RUNTIMEFUNCTION
+#if defined(__x86_64__) && defined(__GNUC__)
+RT_NO_LIBCALL
+#endif
 RtSetMem (
     IN VOID     *Buffer,
     IN UINTN    Size,
     IN UINT8    Value    
     )
 {
-    INT8        *pt;
+    UINT8       *pt;
 
     pt = Buffer;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (Size >= RT_REP_THRESHOLD) {
+        __asm__ __volatile__ ("rep stosb" : "+D" (pt), "+c" (Size) : "a" (Value) : "memory");
+        return;
+    }
+
+    if (Size >= 8) {
+        UINT64  Word = Value * 0x0101010101010101ULL;
+
+        //
+        // One unaligned store covers the head, then aligned words,
+        // and the tail is a last store overlapping the final word.
+        //
+        *(RT_UNALIGNED_UINT64 *) pt = Word;
+        *(RT_UNALIGNED_UINT64 *) (pt + Size - 8) = Word;
+
+        Size -= 8 - ((UINTN) pt & 7);
+        pt += 8 - ((UINTN) pt & 7);
+        while (Size >= 8) {
+            *(UINT64 *) pt = Word;
+            pt += 8;
+            Size -= 8;
+        }
+
+        return;
+    }
+#endif
+
     while (Size--) {
         *(pt++) = Value;
     }
@@ -62,6 +110,9 @@ RtSetMem (
 #endif
 VOID
 RUNTIMEFUNCTION
+#if defined(__x86_64__) && defined(__GNUC__)
+RT_NO_LIBCALL
+#endif
 RtCopyMem (
     IN VOID     *Dest,
     IN CONST VOID     *Src,
@@ -71,9 +122,68 @@ RtCopyMem (
     CHAR8   *d;
     CONST CHAR8 *s = Src;
     d = Dest;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (d == s) {
+        return;
+    }
+
+    //
+    // Copy forward unless Dest starts inside Src, then go backwards
+    // so the overlap is read before it is overwritten.
+    //
+    if ((UINTN) (d - s) >= len) {
+        if (len >= RT_REP_THRESHOLD) {
+            __asm__ __volatile__ ("rep movsb" : "+D" (d), "+S" (s), "+c" (len) : : "memory");
+            return;
+        }
+
+        if (len >= 8) {
+            while ((UINTN) d & 7) {
+                *(d++) = *(s++);
+                len--;
+            }
+
+            while (len >= 8) {
+                *(UINT64 *) d = *(CONST RT_UNALIGNED_UINT64 *) s;
+                d += 8;
+                s += 8;
+                len -= 8;
+            }
+        }
+
+        while (len--) {
+            *(d++) = *(s++);
+        }
+
+        return;
+    }
+
+    d += len;
+    s += len;
+
+    if (len >= 8) {
+        while ((UINTN) d & 7) {
+            *(--d) = *(--s);
+            len--;
+        }
+
+        while (len >= 8) {
+            d -= 8;
+            s -= 8;
+            len -= 8;
+            *(UINT64 *) d = *(CONST RT_UNALIGNED_UINT64 *) s;
+        }
+    }
+
+    while (len--) {
+        *(--d) = *(--s);
+    }
+#else
     while (len--) {
         *(d++) = *(s++);
     }
+#endif
 }
 
 #ifndef __GNUC__
@@ -88,6 +198,19 @@ RtCompareMem (
     )
 {
     CONST CHAR8    *d = Dest, *s = Src;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    //
+    // Skip equal words, the byte loop then finds the first difference
+    // within the next 8 bytes.
+    //
+    while (len >= 8 && *(CONST RT_UNALIGNED_UINT64 *) d == *(CONST RT_UNALIGNED_UINT64 *) s) {
+        d += 8;
+        s += 8;
+        len -= 8;
+    }
+#endif
+
     while (len--) {
         if (*d != *s) {
             return *d - *s;
@@ -125,6 +248,19 @@ Returns:
 
 --*/
 {
+#ifdef __GNUC__
+    //
+    // Compare 64 bits at a time, a GUID is only 4 byte aligned
+    //
+
+    typedef UINT64 __attribute__((__may_alias__, __aligned__(4))) GUID_HALF;
+    CONST GUID_HALF *g1, *g2;
+
+    g1 = (CONST GUID_HALF *) Guid1;
+    g2 = (CONST GUID_HALF *) Guid2;
+
+    return (g1[0] != g2[0]) | (g1[1] != g2[1]);
+#else
     INT32       *g1, *g2, r;
 
     //
@@ -140,6 +276,7 @@ Returns:
     r |= g1[3] - g2[3];
 
     return r;
+#endif
 }
 
 
@@ -17,6 +17,20 @@ Revision History
 
 #include "lib.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+//
+// Strings are scanned four CHAR16s per aligned 64-bit load.  An aligned
+// load never crosses a page, so reading past the terminator within it
+// is safe.  RT_HAS_ZERO16 is non-zero iff one of the four lanes is zero.
+//
+typedef UINT64 __attribute__((__may_alias__)) RT_UINT64;
+typedef UINT64 __attribute__((__may_alias__, __aligned__(1))) RT_UNALIGNED_UINT64;
+
+#define RT_HAS_ZERO16(w)    (((w) - 0x0001000100010001ULL) & ~(w) & 0x8000800080008000ULL)
+#define RT_WORD_ALIGNED(p)  (((UINTN) (p) & 7) == 0)
+#define RT_PAGE_SAFE(p)     (((UINTN) (p) & 0xFFF) <= 0xFF8)
+#endif
+
 #ifndef __GNUC__
 #pragma RUNTIME_CODE(RtStrCmp)
 #endif
@@ -28,6 +42,34 @@ RtStrCmp (
     )
 // compare strings
 {
+#if defined(__x86_64__) && defined(__GNUC__)
+    UINT64      w1;
+
+    while (!RT_WORD_ALIGNED(s1)) {
+        if (*s1 != *s2 || !*s1) {
+            return *s1 - *s2;
+        }
+
+        s1 += 1;
+        s2 += 1;
+    }
+
+    //
+    // s1 is aligned, s2 is loaded unaligned unless that would
+    // cross into the next page
+    //
+
+    while (RT_PAGE_SAFE(s2)) {
+        w1 = *(CONST RT_UINT64 *) s1;
+        if (w1 != *(CONST RT_UNALIGNED_UINT64 *) s2 || RT_HAS_ZERO16(w1)) {
+            break;
+        }
+
+        s1 += 4;
+        s2 += 4;
+    }
+#endif
+
     while (*s1) {
         if (*s1 != *s2) {
             break;
@@ -51,10 +93,7 @@ RtStrCpy (
     )
 // copy strings
 {
-    while (*Src) {
-        *(Dest++) = *(Src++);
-    }
-    *Dest = 0;
+    RtStpCpy (Dest, Src);
 }
 
 #ifndef __GNUC__
@@ -86,6 +125,24 @@ RtStpCpy (
     )
 // copy strings
 {
+#if defined(__x86_64__) && defined(__GNUC__)
+    UINT64      w;
+
+    while (!RT_WORD_ALIGNED(Src)) {
+        if (!*Src) {
+            *Dest = 0;
+            return Dest;
+        }
+        *(Dest++) = *(Src++);
+    }
+
+    for (w = *(CONST RT_UINT64 *) Src; !RT_HAS_ZERO16(w); w = *(CONST RT_UINT64 *) Src) {
+        *(RT_UNALIGNED_UINT64 *) Dest = w;
+        Dest += 4;
+        Src += 4;
+    }
+#endif
+
     while (*Src) {
         *(Dest++) = *(Src++);
     }
@@ -154,10 +211,30 @@ RtStrLen (
     )
 // string length
 {
+#if defined(__x86_64__) && defined(__GNUC__)
+    CONST CHAR16    *p;
+
+    for (p = s1; !RT_WORD_ALIGNED(p); p += 1) {
+        if (!*p) {
+            return p - s1;
+        }
+    }
+
+    while (!RT_HAS_ZERO16(*(CONST RT_UINT64 *) p)) {
+        p += 4;
+    }
+
+    while (*p) {
+        p += 1;
+    }
+
+    return p - s1;
+#else
     UINTN        len;
 
     for (len=0; *s1; s1+=1, len+=1) ;
     return len;
+#endif
 }
 
 #ifndef __GNUC__
@@ -187,10 +264,7 @@ RtStrSize (
     )
 // string size
 {
-    UINTN        len;
-
-    for (len=0; *s1; s1+=1, len+=1) ;
-    return (len + 1) * sizeof(CHAR16);
+    return (RtStrLen(s1) + 1) * sizeof(CHAR16);
 }
 
 #ifndef __GNUC__
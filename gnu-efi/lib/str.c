@@ -68,6 +68,8 @@ LibStubStrLwrUpr (
 {
 }
 
+#define ASCII_UPPER(c)  ((c) >= 'a' && (c) <= 'z' ? (c) - ('a' - 'A') : (c))
+
 INTN
 StriCmp (
     IN CONST CHAR16   *s1,
@@ -75,10 +77,34 @@ StriCmp (
     )
 // compare strings
 {
+    CHAR16      c1, c2;
+
     if (UnicodeInterface == &LibStubUnicodeInterface)
-    	return UnicodeInterface->StriColl(UnicodeInterface, (CHAR16 *)s1, (CHAR16 *)s2);
-    else
-	return uefi_call_wrapper(UnicodeInterface->StriColl, 3, UnicodeInterface, (CHAR16 *)s1, (CHAR16 *)s2);
+    	return RtStrCmp(s1, s2);
+
+    //
+    // Fold ASCII here, only hand the rest of the strings to the
+    // collation protocol once a non-ASCII character shows up
+    //
+
+    for (;;) {
+        c1 = *s1;
+        c2 = *s2;
+        if (c1 >= 0x80 || c2 >= 0x80) {
+            break;
+        }
+
+        c1 = ASCII_UPPER(c1);
+        c2 = ASCII_UPPER(c2);
+        if (c1 != c2 || !c1) {
+            return c1 - c2;
+        }
+
+        s1 += 1;
+        s2 += 1;
+    }
+
+    return uefi_call_wrapper(UnicodeInterface->StriColl, 3, UnicodeInterface, (CHAR16 *)s1, (CHAR16 *)s2);
 }
 
 VOID
@@ -17,11 +17,38 @@ Revision History
 
 #include "lib.h"
 
+//
+// CPU has Enhanced REP MOVSB/STOSB (CPUID.(EAX=7,ECX=0):EBX bit 9),
+// memcpy/memset in init.c use rep movsb/stosb for large sizes when set.
+//
+BOOLEAN LibHasErms = FALSE;
+
+//
+// CPU has PCLMULQDQ (CPUID.1:ECX bit 1), CalculateCrc in crc.c folds
+// with carry-less multiplies when set.
+//
+BOOLEAN LibHasPclmul = FALSE;
+
 VOID
 InitializeLibPlatform (
     IN EFI_HANDLE           ImageHandle EFI_UNUSED,
     IN EFI_SYSTEM_TABLE     *SystemTable EFI_UNUSED
     )
 {
+#if defined(__GNUC__)
+    UINT32 MaxLeaf, Eax, Ebx, Ecx, Edx;
+
+    __asm__ __volatile__ ("cpuid" : "=a" (MaxLeaf), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (0), "c" (0));
+
+    if (MaxLeaf >= 1) {
+        __asm__ __volatile__ ("cpuid" : "=a" (Eax), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (1), "c" (0));
+        LibHasPclmul = (Ecx >> 1) & 1;
+    }
+
+    if (MaxLeaf >= 7) {
+        __asm__ __volatile__ ("cpuid" : "=a" (Eax), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (7), "c" (0));
+        LibHasErms = (Ebx >> 9) & 1;
+    }
+#endif
 }
 
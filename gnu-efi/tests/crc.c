@@ -0,0 +1,145 @@
+/*
+ * Host unit test for lib/crc.c.
+ *
+ * CalculateCrc is checked against the standard CRC32 check vectors and
+ * against a byte-at-a-time reference for every length and alignment up
+ * to MAX_SIZE, once with the slice-by-8 path only and once with
+ * PCLMULQDQ folding (when the host has it).  Buffers end at a PROT_NONE
+ * guard page, so reading past the end faults.
+ *
+ *   make -C tests check
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#define MAX_SIZE	4096
+#define MAX_ALIGN	16
+
+BOOLEAN LibHasPclmul;
+
+static UINT8 *guard;
+static UINTN failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		if (failures++ < 20) {					\
+			printf("%s:%d: ", __func__, __LINE__);		\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while (0)
+
+static UINT32
+ref_crc(const UINT8 *p, UINTN size)
+{
+	UINT32 crc = 0xffffffff;
+
+	while (size--) {
+		crc ^= *p++;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return crc ^ 0xffffffff;
+}
+
+static void
+test_vectors(void)
+{
+	static const struct {
+		const char	*data;
+		UINTN		size;
+		UINT32		crc;
+	} vectors[] = {
+		{ "", 0, 0x00000000 },
+		{ "a", 1, 0xE8B7BE43 },
+		{ "123456789", 9, 0xCBF43926 },
+		{ "The quick brown fox jumps over the lazy dog", 43, 0x414FA339 },
+	};
+	UINT8 buf[64];
+
+	for (UINTN i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		memcpy(buf, vectors[i].data, vectors[i].size);
+		CHECK(CalculateCrc(buf, vectors[i].size) == vectors[i].crc, "vector %lu: %08x",
+		      (unsigned long)i, CalculateCrc(buf, vectors[i].size));
+	}
+
+	memset(buf, 0, 32);
+	CHECK(CalculateCrc(buf, 32) == 0x190A55AD, "32 zero bytes");
+	memset(buf, 0xFF, 32);
+	CHECK(CalculateCrc(buf, 32) == 0xFF6CAB0B, "32 0xFF bytes");
+}
+
+static void
+test_lengths(void)
+{
+	for (UINTN align = 0; align < MAX_ALIGN; align++) {
+		for (UINTN size = 0; size <= MAX_SIZE; size++) {
+			/* as close to the guard page as the alignment allows */
+			UINT8 *p = guard - size;
+
+			p -= ((UINTN)p - align) & (MAX_ALIGN - 1);
+
+			CHECK(CalculateCrc(p, size) == ref_crc(p, size), "size %lu align %lu",
+			      (unsigned long)size, (unsigned long)align);
+		}
+	}
+}
+
+static void
+test_table_header(void)
+{
+	UINT8 table[96] __attribute__((aligned(8)));
+	EFI_TABLE_HEADER *hdr = (EFI_TABLE_HEADER *)table;
+
+	for (UINTN i = 0; i < sizeof(table); i++)
+		table[i] = (UINT8)(i * 29 + 3);
+	hdr->HeaderSize = sizeof(table);
+
+	SetCrc(hdr);
+	CHECK(CheckCrc(sizeof(table), hdr), "CheckCrc after SetCrc");
+	table[sizeof(table) - 1] ^= 1;
+	CHECK(!CheckCrc(sizeof(table), hdr), "CheckCrc of a modified table");
+}
+
+int
+main(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	UINTN span = (MAX_SIZE + MAX_ALIGN + pagesize - 1) / pagesize * pagesize;
+	UINT8 *area;
+	int pass, passes = 1;
+
+	area = mmap(NULL, span + pagesize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED || mprotect(area + span, pagesize, PROT_NONE)) {
+		perror("mmap");
+		return 2;
+	}
+	guard = area + span;
+
+	for (UINTN i = 0; i < span; i++)
+		area[i] = (UINT8)((i * 2654435761u) >> 13);
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("pclmul"))
+		passes = 2;
+	else
+		printf("crc: host has no PCLMULQDQ, folding path not tested\n");
+#endif
+
+	for (pass = 0; pass < passes; pass++) {
+		LibHasPclmul = pass;
+		test_vectors();
+		test_lengths();
+		test_table_header();
+	}
+
+	printf("crc: %s (%lu failures)\n", failures ? "FAIL" : "PASS", (unsigned long)failures);
+	return failures ? 1 : 0;
+}
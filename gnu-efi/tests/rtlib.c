@@ -0,0 +1,357 @@
+/*
+ * Host unit test for lib/runtime/rtstr.c and lib/runtime/efirtlib.c.
+ *
+ * The word-at-a-time string scans and the memory routines are checked
+ * against plain reference loops at every alignment.  Buffers end at a
+ * PROT_NONE guard page, so reading a byte past the end of a string or
+ * buffer crashes the test instead of going unnoticed.
+ *
+ *   make -C tests check
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <efi.h>
+#include <efilib.h>
+#include <efirtlib.h>
+
+#define MAX_LEN		72
+#define MAX_SIZE	600
+#define FILL		0xA5
+
+static UINT8 *page;		/* two usable pages, guard page after them */
+static UINT8 *guard;
+static UINTN failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		if (failures++ < 20) {					\
+			printf("%s:%d: ", __func__, __LINE__);		\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while (0)
+
+static UINTN
+ref_len(const CHAR16 *s)
+{
+	UINTN n = 0;
+
+	while (s[n])
+		n++;
+	return n;
+}
+
+static INTN
+ref_cmp(const CHAR16 *s1, const CHAR16 *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	return *s1 - *s2;
+}
+
+static INTN
+ref_compare_mem(const UINT8 *d, const UINT8 *s, UINTN len)
+{
+	for (; len--; d++, s++)
+		if (*d != *s)
+			return *d - *s;
+	return 0;
+}
+
+/*
+ * A string of len characters whose terminator ends gap bytes before the
+ * guard page.  An odd gap gives a string that is not even CHAR16 aligned.
+ */
+static CHAR16 *
+string_at_guard(UINTN len, UINTN gap, UINTN seed)
+{
+	CHAR16 *s = (CHAR16 *)(guard - gap - (len + 1) * sizeof(CHAR16));
+
+	for (UINTN i = 0; i < len; i++)
+		s[i] = (CHAR16)(1 + (i * 7 + seed) % 90);
+	s[len] = 0;
+	return s;
+}
+
+static void
+test_strlen(void)
+{
+	for (UINTN len = 0; len <= MAX_LEN; len++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			CHAR16 *s = string_at_guard(len, gap, len);
+
+			CHECK(RtStrLen(s) == len, "len %lu gap %lu: %lu",
+			      (unsigned long)len, (unsigned long)gap, (unsigned long)RtStrLen(s));
+			CHECK(RtStrSize(s) == (len + 1) * sizeof(CHAR16), "size len %lu gap %lu",
+			      (unsigned long)len, (unsigned long)gap);
+			CHECK(RtStrnLen(s, len / 2) == len / 2, "strnlen len %lu gap %lu",
+			      (unsigned long)len, (unsigned long)gap);
+			CHECK(RtStrnLen(s, len + 5) == len, "strnlen len %lu gap %lu",
+			      (unsigned long)len, (unsigned long)gap);
+		}
+	}
+}
+
+static void
+test_strcmp(void)
+{
+	static const CHAR16 diffs[] = { 0, 1, 0x7F, 0x80, 0x8000, 0xFFFF };
+
+	for (UINTN len = 0; len <= MAX_LEN; len++) {
+		for (UINTN gap = 0; gap < 16; gap += 2) {
+			for (UINTN off = 0; off < 16; off++) {
+				/* s1 ends at the guard page, s2 anywhere in the page before */
+				CHAR16 *s1 = string_at_guard(len, gap, 3);
+				CHAR16 *s2 = (CHAR16 *)(page + 64 + off);
+
+				memcpy(s2, s1, (len + 1) * sizeof(CHAR16));
+				CHECK(RtStrCmp(s1, s2) == 0 && RtStrCmp(s2, s1) == 0,
+				      "equal len %lu gap %lu off %lu",
+				      (unsigned long)len, (unsigned long)gap, (unsigned long)off);
+
+				for (UINTN at = 0; at <= len; at++) {
+					for (UINTN d = 0; d < sizeof(diffs) / sizeof(diffs[0]); d++) {
+						CHAR16 saved = s2[at];
+
+						if (diffs[d] == saved)
+							continue;
+						s2[at] = diffs[d];
+						CHECK(RtStrCmp(s1, s2) == ref_cmp(s1, s2) &&
+						      RtStrCmp(s2, s1) == ref_cmp(s2, s1),
+						      "len %lu gap %lu off %lu at %lu",
+						      (unsigned long)len, (unsigned long)gap,
+						      (unsigned long)off, (unsigned long)at);
+						s2[at] = saved;
+					}
+				}
+			}
+		}
+	}
+
+	/* Both strings ending at the guard page, s2 still unaligned */
+	for (UINTN len = 0; len <= MAX_LEN; len++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			CHAR16 *s2 = string_at_guard(len, gap, 5);
+			CHAR16 s1[MAX_LEN + 8] __attribute__((aligned(8)));
+
+			memcpy(s1, s2, (len + 1) * sizeof(CHAR16));
+			CHECK(RtStrCmp(s1, s2) == 0, "tail len %lu gap %lu",
+			      (unsigned long)len, (unsigned long)gap);
+			if (len) {
+				s1[len - 1] += 1;
+				CHECK(RtStrCmp(s1, s2) == ref_cmp(s1, s2), "tail diff len %lu gap %lu",
+				      (unsigned long)len, (unsigned long)gap);
+			}
+		}
+	}
+}
+
+static void
+test_strcpy(void)
+{
+	UINT8 dest[2 * MAX_LEN + 64];
+
+	for (UINTN len = 0; len <= MAX_LEN; len++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			for (UINTN off = 0; off < 16; off++) {
+				CHAR16 *src = string_at_guard(len, gap, 11);
+				CHAR16 *d = (CHAR16 *)(dest + off);
+				UINTN size = (len + 1) * sizeof(CHAR16);
+				CHAR16 *end;
+
+				memset(dest, FILL, sizeof(dest));
+				end = RtStpCpy(d, src);
+				CHECK(end == d + len, "stpcpy end len %lu gap %lu off %lu",
+				      (unsigned long)len, (unsigned long)gap, (unsigned long)off);
+				CHECK(memcmp(d, src, size) == 0 && dest[off + size] == FILL,
+				      "stpcpy len %lu gap %lu off %lu",
+				      (unsigned long)len, (unsigned long)gap, (unsigned long)off);
+
+				memset(dest, FILL, sizeof(dest));
+				RtStrCpy(d, src);
+				CHECK(memcmp(d, src, size) == 0 && dest[off + size] == FILL,
+				      "strcpy len %lu gap %lu off %lu",
+				      (unsigned long)len, (unsigned long)gap, (unsigned long)off);
+			}
+		}
+	}
+}
+
+static void
+test_strcat(void)
+{
+	CHAR16 dest[2 * MAX_LEN + 8];
+
+	for (UINTN len = 0; len <= MAX_LEN; len += 3) {
+		for (UINTN gap = 0; gap < 8; gap++) {
+			CHAR16 *src = string_at_guard(len, gap, 13);
+
+			dest[0] = 'a';
+			dest[1] = 'b';
+			dest[2] = 0;
+			RtStrCat(dest, src);
+			CHECK(ref_len(dest) == len + 2 && ref_cmp(dest + 2, src) == 0,
+			      "strcat len %lu gap %lu", (unsigned long)len, (unsigned long)gap);
+
+			dest[2] = 0;
+			RtStrnCat(dest, src, len / 2);
+			CHECK(ref_len(dest) == len / 2 + 2 && memcmp(dest + 2, src, len / 2 * sizeof(CHAR16)) == 0,
+			      "strncat len %lu gap %lu", (unsigned long)len, (unsigned long)gap);
+
+			memset(dest, FILL, sizeof(dest));
+			RtStrnCpy(dest, src, len + 4);
+			CHECK(memcmp(dest, src, len * sizeof(CHAR16)) == 0 &&
+			      !dest[len] && !dest[len + 3] && dest[len + 4] == (FILL | FILL << 8),
+			      "strncpy len %lu gap %lu", (unsigned long)len, (unsigned long)gap);
+		}
+	}
+}
+
+static void
+test_setmem(void)
+{
+	for (UINTN size = 0; size <= MAX_SIZE; size++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			UINT8 *p = guard - gap - size;
+
+			memset(p - 16, FILL, size + gap + 16);
+			RtSetMem(p, size, (UINT8)size);
+			for (UINTN i = 0; i < size; i++)
+				CHECK(p[i] == (UINT8)size, "size %lu gap %lu at %lu",
+				      (unsigned long)size, (unsigned long)gap, (unsigned long)i);
+			for (UINTN i = 1; i <= 16; i++)
+				CHECK(p[-(INTN)i] == FILL, "size %lu gap %lu before",
+				      (unsigned long)size, (unsigned long)gap);
+			for (UINTN i = 0; i < gap; i++)
+				CHECK(p[size + i] == FILL, "size %lu gap %lu after",
+				      (unsigned long)size, (unsigned long)gap);
+
+			RtZeroMem(p, size);
+			for (UINTN i = 0; i < size; i++)
+				CHECK(!p[i], "zero size %lu gap %lu at %lu",
+				      (unsigned long)size, (unsigned long)gap, (unsigned long)i);
+		}
+	}
+}
+
+static void
+test_copymem(void)
+{
+	static UINT8 ref[2 * MAX_SIZE + 64];
+	UINT8 *area = page + 1024;
+
+	/* Disjoint buffers, the source ending at the guard page */
+	for (UINTN size = 0; size <= MAX_SIZE; size++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			for (UINTN off = 0; off < 16; off += 3) {
+				UINT8 *s = guard - gap - size;
+				UINT8 *d = area + off;
+
+				for (UINTN i = 0; i < size; i++)
+					s[i] = (UINT8)(i * 13 + gap);
+				memset(d - 8, FILL, size + 16);
+				RtCopyMem(d, s, size);
+				CHECK(memcmp(d, s, size) == 0, "size %lu gap %lu off %lu",
+				      (unsigned long)size, (unsigned long)gap, (unsigned long)off);
+				CHECK(d[-1] == FILL && d[size] == FILL, "bounds size %lu gap %lu off %lu",
+				      (unsigned long)size, (unsigned long)gap, (unsigned long)off);
+			}
+		}
+	}
+
+	/* Overlapping copies in both directions, against memmove semantics */
+	for (UINTN size = 0; size <= MAX_SIZE; size += (size < 40 ? 1 : 7)) {
+		for (INTN shift = -19; shift <= 19; shift++) {
+			UINT8 *s = area + 64;
+			UINT8 *d = s + shift;
+
+			for (UINTN i = 0; i < sizeof(ref); i++)
+				area[i] = (UINT8)(i * 31 + 7);
+			memcpy(ref, area, sizeof(ref));
+			memmove(ref + 64 + shift, ref + 64, size);
+
+			RtCopyMem(d, s, size);
+			CHECK(memcmp(area, ref, sizeof(ref)) == 0, "overlap size %lu shift %ld",
+			      (unsigned long)size, (long)shift);
+		}
+	}
+}
+
+static void
+test_comparemem(void)
+{
+	static const UINT8 diffs[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+
+	for (UINTN size = 0; size <= 80; size++) {
+		for (UINTN gap = 0; gap < 16; gap++) {
+			UINT8 *a = guard - gap - size;
+			UINT8 *b = page + 200 + gap;
+
+			for (UINTN i = 0; i < size; i++)
+				a[i] = b[i] = (UINT8)(i * 5 + 1);
+			CHECK(RtCompareMem(a, b, size) == 0, "equal size %lu gap %lu",
+			      (unsigned long)size, (unsigned long)gap);
+
+			for (UINTN at = 0; at < size; at++) {
+				for (UINTN d = 0; d < sizeof(diffs); d++) {
+					UINT8 saved = b[at];
+
+					b[at] = diffs[d];
+					CHECK(RtCompareMem(a, b, size) == ref_compare_mem(a, b, size) &&
+					      RtCompareMem(b, a, size) == ref_compare_mem(b, a, size),
+					      "size %lu gap %lu at %lu",
+					      (unsigned long)size, (unsigned long)gap, (unsigned long)at);
+					b[at] = saved;
+				}
+			}
+		}
+	}
+}
+
+static void
+test_compareguid(void)
+{
+	EFI_GUID g1, g2;
+
+	memset(&g1, 0x5A, sizeof(g1));
+	g2 = g1;
+	CHECK(RtCompareGuid(&g1, &g2) == 0, "equal");
+
+	for (UINTN i = 0; i < sizeof(g1); i++) {
+		g2 = g1;
+		((UINT8 *)&g2)[i] ^= 0x10;
+		CHECK(RtCompareGuid(&g1, &g2) != 0, "byte %lu", (unsigned long)i);
+	}
+}
+
+int
+main(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	page = mmap(NULL, 3 * pagesize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED || mprotect(page + 2 * pagesize, pagesize, PROT_NONE)) {
+		perror("mmap");
+		return 2;
+	}
+	guard = page + 2 * pagesize;
+
+	test_strlen();
+	test_strcmp();
+	test_strcpy();
+	test_strcat();
+	test_setmem();
+	test_copymem();
+	test_comparemem();
+	test_compareguid();
+
+	printf("rtlib: %s (%lu failures)\n", failures ? "FAIL" : "PASS", (unsigned long)failures);
+	return failures ? 1 : 0;
+}
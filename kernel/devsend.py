@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Host side of the loader's serial dev mode (dev=serial).
+# Sends a kernel image when the loader asks for one, then prints the serial console.
+#
+#   make rundev-serial                  # in one terminal
+#   python3 devsend.py bin/kernel.elf   # in another
+
+import socket
+import struct
+import sys
+import zlib
+
+DEV_MAGIC = 0x56454446  # "FDEV"
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else "bin/kernel.elf"
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 4555
+
+    with open(path, "rb") as f:
+        image = f.read()
+
+    length = len(image)
+    packet = struct.pack("<IIII", DEV_MAGIC, length, zlib.crc32(image), ~length & 0xFFFFFFFF) + image
+
+    conn = socket.create_connection(("localhost", port))
+    tail = b""
+    sent = done = False
+
+    while True:
+        data = conn.recv(4096)
+        if not data:
+            break
+
+        sys.stdout.buffer.write(data)
+        sys.stdout.flush()
+
+        if done:
+            continue
+
+        tail = (tail + data)[-16:]
+        if b"FDEV+" in tail:
+            done = True
+        elif b"FDEV-" in tail or (b"FDEV?" in tail and not sent):
+            conn.sendall(packet)
+            sent = True
+            tail = b""
+
+
+if __name__ == "__main__":
+    main()
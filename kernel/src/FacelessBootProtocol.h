@@ -70,6 +70,89 @@ struct __attribute__((packed)) BMP {
     char pixel_data[];
 };
 
+#define FACELESS_CPU_BSP      (1 << 0)
+#define FACELESS_CPU_PARKED   (1 << 1)        // AP is spinning on its mailbox.
+
+// Memory map type of the AP startup page.
+#define FACELESS_MEMORY_AP_STARTUP    0x80000003
+
+/*
+ *  One per CPU. No AP is running at handoff: start them on
+ *  ap_startup, each one then sets FACELESS_CPU_PARKED. Write an
+ *  entry point to goto_address to release a parked AP, it will
+ *  be called with a pointer to its FacelessCpu on a loader
+ *  allocated stack.
+ */
+struct FacelessCpu {
+    uint32_t apic_id;
+    uint32_t flags;
+    volatile uint64_t goto_address;
+    uint64_t extra_argument;            // Free for the kernel to use.
+    uint64_t stack_top;
+    uint64_t percpu;                    // GS base, 0 if per-CPU areas are disabled.
+} __attribute__((aligned(64)));
+
+#define FACELESS_MAX_BOOT_STAGES 32
+
+// TSC taken at a named point while the loader ran.
+struct FacelessBootStage {
+    char name[24];
+    uint64_t tsc;
+};
+
+struct FacelessBootTrace {
+    uint32_t count;
+    struct FacelessBootStage stages[FACELESS_MAX_BOOT_STAGES];
+};
+
+// Memory map type of the boot log region.
+#define FACELESS_MEMORY_BOOT_LOG      0x80000001
+
+// Memory map type of the loader arena: font, memory map and other small loader data.
+#define FACELESS_MEMORY_LOADER_ARENA  0x80000002
+
+// Loader text, each line starts with a [seconds.micros] stamp.
+// Bytes text[i % size] for i in [head - size, head) when head > size, else [0, head).
+struct FacelessBootLog {
+    uint64_t size;
+    uint64_t head;                  // Bytes ever written.
+    char text[];
+};
+
+// Must match BOOT_HISTORY_LEN in the loader's config.h.
+#define FACELESS_BOOT_HISTORY_LEN     16
+#define FACELESS_BOOT_HISTORY_STAGES  12
+
+// One boot, stage_us[i] is the time taken by boot_trace->stages[i].
+struct FacelessBootRecord {
+    uint32_t seq;                   // Increases every boot, 0 marks an empty slot.
+    uint16_t n_stages;
+    uint16_t entry;                 // Boot entry that was picked.
+    uint32_t total_us;
+    uint32_t stage_us[FACELESS_BOOT_HISTORY_STAGES];
+};
+
+// Ring of the last boots, records[(next - 1) % LEN] is the current one.
+struct FacelessBootHistory {
+    uint32_t version;
+    uint32_t next;
+    struct FacelessBootRecord records[FACELESS_BOOT_HISTORY_LEN];
+};
+
+// reset_system() types, same values as EFI_RESET_TYPE.
+#define FACELESS_RESET_COLD       0
+#define FACELESS_RESET_WARM       1
+#define FACELESS_RESET_SHUTDOWN   2
+
+// Module the loader read into memory for the kernel.
+struct FacelessModule {
+    void* base;
+    uint64_t size;
+    char path[64];
+};
+
+// Passed to the kernel by value. Fields are only ever added at the end, so a
+// kernel built against an older copy of this struct still reads the fields it knows.
 struct RuntimeDataAndServices {
     struct Framebuffer {
         void* base_addr;
@@ -120,6 +203,76 @@ struct RuntimeDataAndServices {
     void(*term_write)(const char* str, uint32_t color);
     uint64_t(*get_mmap_entries)(void);
     struct FacelessMemoryDescriptor*(*index_mmap)(uint64_t index);
+
+    // Firmware configuration tables, NULL if not present.
+    struct ConfigTables {
+        void* rsdp;                 // ACPI 1.0 RSDP.
+        void* xsdp;                 // ACPI 2.0+ RSDP (has XSDT address).
+        void* smbios;               // SMBIOS 2.x entry point.
+        void* smbios3;              // SMBIOS 3.x (64-bit) entry point.
+        void* system_table;         // EFI_SYSTEM_TABLE.
+    } config_tables;
+
+    struct Smp {
+        uint64_t cpu_count;
+        uint32_t bsp_apic_id;
+        struct FacelessCpu* cpus;
+        volatile uint64_t* release_all;     // Entry point written here releases every parked AP.
+        uint64_t percpu_size;
+    } smp;
+
+    struct KernelStack {
+        uint64_t guard;             // Guard page, just below base.
+        uint64_t base;
+        uint64_t top;               // Initial rsp.
+    } kernel_stack;
+
+    struct Timebase {
+        uint64_t tsc_frequency;     // Hz, 0 if it could not be calibrated.
+        uint64_t boot_tsc;          // TSC at loader entry.
+        uint8_t invariant_tsc;      // TSC runs at a constant rate in all P/C states.
+    } timebase;
+
+    struct FacelessBootTrace* boot_trace;
+
+    struct Modules {
+        uint64_t count;
+        struct FacelessModule* list;
+    } modules;
+
+    const char* cmdline;            // Command line of the booted entry, never NULL.
+
+    // FACELESS_RESET_* through efi_runtime.rt. Code in the loader image, keep it
+    // identity mapped and the runtime regions mapped at virtAddr to call this.
+    void(*reset_system)(uint32_t type);
+
+    // Runtime services after SetVirtualAddressMap, rt is NULL if the firmware refused the map.
+    // Runtime regions sit at physAddr + virt_offset (virtAddr in the memory map).
+    struct EfiRuntime {
+        void* rt;                   // EFI_RUNTIME_SERVICES.
+        uint64_t virt_offset;
+        // EFI services use the Microsoft ABI, call them through this thunk.
+        uint64_t(*efi_call)(void* func, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5);
+    } efi_runtime;
+
+    struct FacelessBootHistory* boot_history;   // NULL if it could not be saved.
+
+    // Serial console, write and flush are NULL if there is no UART.
+    struct Serial {
+        uint16_t port;
+        void(*write)(const char* str);      // Buffered, sends what fits in the FIFO and returns.
+        void(*flush)(void);                 // Waits until everything is on the wire.
+    } serial;
+
+    struct FacelessBootLog* boot_log;           // NULL if the loader kept no log.
+
+    // Real mode startup page for the APs, page is 0 if there is none
+    // (a single CPU, or the loader's page tables are above 4 GiB).
+    // Send INIT-SIPI-SIPI with vector page >> 12 to start them.
+    struct ApStartup {
+        uint64_t page;                      // Below 1 MiB.
+        uint32_t* cr3;                      // Page table root the APs load, must be below 4 GiB.
+    } ap_startup;
 } runtime_services;
 
 #endif
@@ -1,12 +1,30 @@
 #include <FacelessBootProtocol.h>
 
-void _start(struct RuntimeDataAndServices services) {
-    for (uint64_t i = 0; i < 99999999; ++i) {
-        __asm__ __volatile__("cli");
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+// Busy waits using the TSC frequency the loader calibrated.
+static void delay_ms(struct RuntimeDataAndServices* services, uint64_t ms) {
+    uint64_t end = rdtsc() + services->timebase.tsc_frequency / 1000 * ms;
+    while (rdtsc() < end) {
+        __asm__ __volatile__("pause");
     }
+}
 
-    services.refresh_wallpaper();
-    services.display_terminal(250, 50);
+
+void _start(struct RuntimeDataAndServices services) {
+    __asm__ __volatile__("cli");
+    delay_ms(&services, 500);
+
+    // Not available when the loader booted without a wallpaper.
+    if (services.refresh_wallpaper && services.display_terminal) {
+        services.refresh_wallpaper();
+        services.display_terminal(250, 50);
+    }
 
     services.term_write("Hello from the kernel!", 0x00FF00);
     __asm__ __volatile__("cli; hlt");